@@ -28,12 +28,41 @@
 
 #pragma once
 
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cctype>
+#include <charconv>
+#include <cmath>
+#include <condition_variable>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
 #include <exception>
+#include <functional>
+#include <iterator>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <thread>
+#include <tuple>
+#include <type_traits>
+#include <vector>
+
+#include <emmintrin.h>
 
 #define WIN32_LEAN_AND_MEAN
 #include <Windows.h>
 #include <Windowsx.h>
+#include <dwmapi.h>
+#include <Xinput.h>
+#include <avrt.h>
+
+#ifdef _MSC_VER
+#pragma comment(lib, "Dwmapi.lib")
+#endif
 
 namespace SWL
 {
@@ -52,17 +81,609 @@ namespace SWL
         void ShowDebugOutput();
     };
 
+    /*=========================================================================
+     * Surface definition
+     *
+     * Non owning view over 32-bit BGRA pixels, nStride being counted in pixels.
+     *=========================================================================*/
+    struct Surface
+    {
+        UINT32* pPixels = nullptr;
+        int nWidth = 0;
+        int nHeight = 0;
+        int nStride = 0;
+
+        UINT32* GetRow(int y) const { return pPixels + (SIZE_T)y * nStride; }
+    };
+
+    /*=========================================================================
+     * Pixel memory definition
+     *
+     * Storage and bulk kernels for large pixel buffers. Buffers from 256 KiB
+     * are taken from the system in whole pages, and from large pages once
+     * EnableLargePages succeeded, which cuts the TLB misses of walking 4K and
+     * 8K images. Whole surface fills and copies past the streaming threshold
+     * use non-temporal stores so they do not evict the rest of the working
+     * set, the threshold being measured by TuneStreamingThreshold.
+     *=========================================================================*/
+    class PixelBuffer
+    {
+    private:
+        static constexpr SIZE_T s_nPageThreshold = 256 * 1024;
+        static std::atomic<BOOL> s_bLargePages;
+
+        UINT32* m_pPixels = nullptr;
+        SIZE_T m_nCount = 0;
+        SIZE_T m_nCapacity = 0;
+        BOOL m_bPages = FALSE;          // VirtualAlloc instead of the heap
+        BOOL m_bLargePages = FALSE;
+
+        void Release();
+
+    public:
+        PixelBuffer() = default;
+        // Zero initialized
+        explicit PixelBuffer(SIZE_T nCount);
+        ~PixelBuffer() { Release(); }
+
+        PixelBuffer(PixelBuffer&& other) noexcept;
+        PixelBuffer& operator=(PixelBuffer&& other) noexcept;
+        PixelBuffer(const PixelBuffer&) = delete;
+        PixelBuffer& operator=(const PixelBuffer&) = delete;
+
+        // Zero initialized, the allocation is kept when it is large enough and the new size stays on the
+        // same side of the page threshold
+        void Resize(SIZE_T nCount);
+
+        // Enables SeLockMemoryPrivilege so that the following buffers use large pages, FALSE when the
+        // account lacks the "Lock pages in memory" right. Without a free large page, regular pages are used
+        static BOOL EnableLargePages();
+
+        UINT32* GetData() const { return m_pPixels; }
+        SIZE_T GetCount() const { return m_nCount; }
+        BOOL IsLargePages() const { return m_bLargePages; }
+    };
+
+    // Whole surface kernels, CopySurface copying the area both surfaces share
+    void FillSurface(const Surface& dst, UINT32 uColor);
+    void CopySurface(const Surface& dst, const Surface& src);
+
+    // Surfaces of this many bytes or more are written with non-temporal stores, MAXSIZE_T disabling them.
+    // TuneStreamingThreshold measures it once (a few tens of milliseconds) unless it was set, and is best
+    // called at startup. Otherwise the first kernel call on a surface of 1 MiB or more measures it
+    void TuneStreamingThreshold();
+    SIZE_T GetStreamingThreshold();
+    void SetStreamingThreshold(SIZE_T nBytes);
+
+    /*=========================================================================
+     * Image definition
+     *
+     * Owning 32-bit premultiplied BGRA pixel storage.
+     *=========================================================================*/
+    class Image
+    {
+    private:
+        PixelBuffer m_pixels{};
+        Surface m_surface{};
+
+    public:
+        Image() = default;
+        Image(int nWidth, int nHeight);
+        Image(const Image& other);
+        Image(Image&& other) noexcept;
+        Image& operator=(const Image& other);
+        Image& operator=(Image&& other) noexcept;
+
+        void Resize(int nWidth, int nHeight);
+        void Clear(UINT32 uColor = 0);
+
+        const Surface& GetSurface() const { return m_surface; }
+        int GetWidth() const { return m_surface.nWidth; }
+        int GetHeight() const { return m_surface.nHeight; }
+        BOOL IsLargePages() const { return m_pixels.IsLargePages(); }
+    };
+
+    /*=========================================================================
+     * Metrics definition
+     *
+     * Counters and histograms of an Application, published in a named shared
+     * memory segment so an external monitor can watch a running window. They
+     * accumulate in process memory and are copied to the segment once per pump
+     * under a sequence lock, readers retrying when they catch a copy halfway.
+     *=========================================================================*/
+    struct Metrics
+    {
+        static constexpr UINT s_uBucketCount = 24;
+        static constexpr UINT s_uCounterCount = 8;
+
+        UINT64 ullMessages;                // Dispatched messages
+        UINT64 ullPumps;
+        UINT64 ullFrames;
+        UINT32 uLastPumpMessages;          // Messages dispatched by the last pump, what the queue held
+        UINT32 uMaxPumpMessages;
+        LONGLONG llLastDispatchTicks;
+        LONGLONG llLastRenderTicks;
+        LONGLONG llLastFrameTicks;         // Interval between the last two consecutive frames
+        // Bucket i counts durations of [2^i, 2^(i+1)) microseconds, bucket 0 including shorter ones
+        UINT64 ullDispatchHistogram[s_uBucketCount];
+        UINT64 ullFrameHistogram[s_uBucketCount];
+        LONGLONG llCounters[s_uCounterCount]; // Set by the application, queue depths for example
+    };
+
+    // Layout of the shared segment, uVersion changes whenever Metrics does
+    struct MetricsSegment
+    {
+        static constexpr UINT32 s_uMagic = 0x544D5753; // 'SWMT'
+        static constexpr UINT32 s_uVersion = 1;
+
+        UINT32 uMagic;
+        UINT32 uVersion;
+        UINT32 uSize;
+        DWORD dwProcessId;
+        LONGLONG llFrequency;
+        alignas(64) std::atomic<UINT32> uSequence;
+        Metrics metrics;
+    };
+
+    class MetricsPublisher
+    {
+    private:
+        HANDLE m_hMapping = NULL;
+        MetricsSegment* m_pSegment = nullptr;
+        Metrics m_metrics{};
+        double m_dMicrosecondsPerTick = 0;
+        LONGLONG m_llLastFrame = 0;
+
+        UINT GetBucket(LONGLONG llTicks) const;
+
+    public:
+        MetricsPublisher() = default;
+        ~MetricsPublisher();
+
+        MetricsPublisher(const MetricsPublisher&) = delete;
+        MetricsPublisher& operator=(const MetricsPublisher&) = delete;
+
+        void Create(LPCWSTR lpName);
+        BOOL IsEnabled() const { return m_pSegment != nullptr; }
+
+        void RecordDispatch(LONGLONG llTicks);
+        void RecordPump(UINT32 uMessages);
+        // llPresented is the QueryPerformanceCounter value once the frame was handed to the compositor
+        void RecordFrame(LONGLONG llRenderTicks, LONGLONG llPresented);
+        // Breaks the frame interval, the next frame starting a new sequence
+        void RecordIdle() { m_llLastFrame = 0; }
+        void SetCounter(UINT uIndex, LONGLONG llValue);
+
+        void Publish();
+    };
+
+    class MetricsReader
+    {
+    private:
+        HANDLE m_hMapping = NULL;
+        const MetricsSegment* m_pSegment = nullptr;
+
+    public:
+        MetricsReader(LPCWSTR lpName);
+        ~MetricsReader();
+
+        MetricsReader(const MetricsReader&) = delete;
+        MetricsReader& operator=(const MetricsReader&) = delete;
+
+        // Returns FALSE when no consistent snapshot could be taken after a few attempts
+        BOOL Read(Metrics& metrics) const;
+
+        DWORD GetProcessId() const { return m_pSegment->dwProcessId; }
+        LONGLONG GetFrequency() const { return m_pSegment->llFrequency; }
+    };
+
+    /*=========================================================================
+     * Clock definition
+     *
+     * Monotonic clocks for the Application template, QpcClock being the
+     * default. Any type providing the same static functions can replace it,
+     * a manually advanced clock for example.
+     *=========================================================================*/
+    struct QpcClock
+    {
+        static LONGLONG Now();
+        static LONGLONG GetFrequency();
+    };
+
+    // Timing of the event being handled
+    struct EventTime
+    {
+        LONGLONG llTimestamp;   // ClockType ticks, taken when the message was retrieved from the queue
+        DWORD dwMessageTime;    // MSG::time, milliseconds on the GetTickCount timeline
+    };
+
+    /*=========================================================================
+     * PointerPredictor definition
+     *
+     * Extrapolates the pointer to a future time, typically when the frame
+     * being rendered reaches the screen, to hide the input to display latency
+     * while dragging. Samples are smoothed by a One-Euro filter (strong when
+     * slow, little lag when fast), then a least squares polynomial fitted on
+     * the most recent ones is evaluated at the target time.
+     *=========================================================================*/
+    class PointerPredictor
+    {
+    public:
+        struct Settings
+        {
+            float fMinCutoff = 1.0f;          // Hz, smoothing of a slow pointer
+            float fBeta = 0.01f;              // Cutoff increase per pixel per second
+            float fDerivativeCutoff = 1.0f;   // Hz, smoothing of the speed driving the cutoff
+            float fAggressiveness = 1.0f;     // Fraction of the time to the target actually predicted
+            float fStopTimeout = 0.05f;       // Seconds without a sample after which the pointer is stopped
+            float fMaxHorizon = 0.1f;         // Seconds, predictions never reach further past the last sample
+            float fWindow = 0.05f;            // Seconds of samples the polynomial is fitted on
+            UINT uDegree = 1;                 // 1 for velocity, 2 for velocity and acceleration
+        };
+
+    private:
+        struct Sample
+        {
+            LONGLONG llTimestamp;
+            float x;
+            float y;
+        };
+
+        static constexpr UINT s_uMaxSamples = 16;
+
+        Settings m_settings{};
+        double m_dTickPeriod;
+        Sample m_samples[s_uMaxSamples] = {};
+        UINT m_uCount = 0;
+        UINT m_uNext = 0;
+        float m_fSpeed = 0;
+        Sample m_raw{};
+
+    public:
+        // Timestamps are ticks of a clock running at llFrequency
+        PointerPredictor(LONGLONG llFrequency);
+        PointerPredictor(LONGLONG llFrequency, const Settings& settings);
+
+        const Settings& GetSettings() const { return m_settings; }
+        void SetSettings(const Settings& settings) { m_settings = settings; }
+
+        void AddSample(float x, float y, LONGLONG llTimestamp);
+        void Reset() { m_uCount = 0; }
+
+        // Position expected at llTarget, llNow telling how old the last sample is. FALSE until a sample was added
+        BOOL Predict(LONGLONG llNow, LONGLONG llTarget, float* px, float* py) const;
+    };
+
+    /*=========================================================================
+     * Pointer input definition
+     *
+     * Pen, touch and touchpad samples from WM_POINTER messages. Every message
+     * delivers the whole history coalesced since the previous one, oldest
+     * sample first, so no intermediate position of a fast stroke is lost.
+     * PointerContacts keeps the state of every contact currently down.
+     *=========================================================================*/
+    struct PointerSample
+    {
+        UINT32 uPointerId;
+        POINTER_INPUT_TYPE type;    // PT_PEN, PT_TOUCH, PT_TOUCHPAD or PT_MOUSE
+        POINTER_FLAGS dwFlags;      // POINTER_FLAG_DOWN, POINTER_FLAG_INCONTACT, POINTER_FLAG_UP...
+        UINT32 uPenFlags;           // PEN_FLAG_BARREL, PEN_FLAG_ERASER...
+        LONGLONG llTimestamp;       // Application clock ticks
+        float x;                    // Client coordinates
+        float y;
+        float fPressure;            // 0 to 1, 1 in contact for devices without pressure
+        float fTiltX;               // Degrees, pens only
+        float fTiltY;
+        float fRotation;            // Degrees clockwise, pens only
+    };
+
+    class PointerContacts
+    {
+    public:
+        struct Contact
+        {
+            PointerSample first;    // Sample that put the contact down
+            PointerSample last;
+        };
+
+    private:
+        std::vector<Contact> m_contacts{};
+
+    public:
+        // Samples in chronological order, as delivered to OnPointer
+        void Update(const PointerSample* pSamples, UINT uCount);
+        void Remove(UINT32 uPointerId);
+        void Clear() { m_contacts.clear(); }
+
+        const Contact* Find(UINT32 uPointerId) const;
+        const std::vector<Contact>& GetContacts() const { return m_contacts; }
+    };
+
+    /*=========================================================================
+     * Gamepad definition
+     *
+     * Gamepads polled on a dedicated thread so a slow or disconnected device
+     * never stalls rendering. The latest state of each pad is exchanged
+     * through a sequence lock, and button and connection changes are posted
+     * to the window as GetGamepadMessage messages, which an Application turns
+     * into OnGamepadButtons and OnGamepadConnection calls. Disconnected pads
+     * are only probed every dwProbeInterval, as XInput is slow to report them.
+     *=========================================================================*/
+    struct GamepadState
+    {
+        BOOL bConnected;
+        DWORD dwPacket;
+        WORD wButtons;          // XINPUT_GAMEPAD_* masks
+        float fLeftTrigger;     // 0 to 1 past the trigger deadzone
+        float fRightTrigger;
+        float fLeftX;           // -1 to 1 past the radial stick deadzones, y up
+        float fLeftY;
+        float fRightX;
+        float fRightY;
+    };
+
+    // Registered message posted by GamepadPoller, wParam holding the pad and the event kind. Registration
+    // happens on the first call, PeekGamepadMessage returns 0 until then
+    UINT GetGamepadMessage();
+    UINT PeekGamepadMessage();
+
+    // Default device source, any type with the same GetState function can replace it (a mock for example).
+    // XInput is loaded on the first call, every pad reading as disconnected when it is missing
+    struct XInputSource
+    {
+        DWORD GetState(DWORD dwUserIndex, XINPUT_STATE* pState);
+    };
+
+    template<class SourceType = XInputSource>
+    class GamepadPoller
+    {
+    public:
+        static constexpr UINT s_uMaxPads = XUSER_MAX_COUNT;
+
+        enum Event : WORD
+        {
+            Buttons,            // lParam low word pressed buttons, high word released buttons
+            Connected,
+            Disconnected
+        };
+
+    private:
+        struct Slot
+        {
+            alignas(64) std::atomic<UINT32> uSequence;
+            GamepadState state;
+        };
+
+        SourceType m_source;
+        HWND m_hWnd;
+        DWORD m_dwInterval;
+        DWORD m_dwProbeInterval;
+        float m_fLeftDeadzone = XINPUT_GAMEPAD_LEFT_THUMB_DEADZONE / 32767.0f;
+        float m_fRightDeadzone = XINPUT_GAMEPAD_RIGHT_THUMB_DEADZONE / 32767.0f;
+        float m_fTriggerDeadzone = XINPUT_GAMEPAD_TRIGGER_THRESHOLD / 255.0f;
+        Slot m_slots[s_uMaxPads] = {};
+        HANDLE m_hStopEvent = NULL;
+        std::thread m_thread{};
+
+        void Convert(const XINPUT_GAMEPAD& gamepad, GamepadState& state) const;
+        void Publish(UINT uPad, const GamepadState& state);
+        void Run();
+
+    public:
+        // Polls every dwInterval milliseconds and posts the events to hWnd
+        GamepadPoller(HWND hWnd, DWORD dwInterval = 4, DWORD dwProbeInterval = 1000, SourceType source = SourceType());
+        ~GamepadPoller();
+
+        GamepadPoller(const GamepadPoller&) = delete;
+        GamepadPoller& operator=(const GamepadPoller&) = delete;
+
+        // Latest state of the pad, callable from any thread
+        GamepadState GetState(UINT uPad) const;
+        SourceType& GetSource() { return m_source; }
+    };
+
+    /*=========================================================================
+     * Thread scheduling definition
+     *
+     * Policies applied to the calling thread for the lifetime of a
+     * ThreadSchedule, so the message, render and worker threads keep their
+     * share of the CPU on a loaded machine. The multimedia class scheduler
+     * (MMCSS) boosts a registered thread above normal processes without the
+     * risk of a realtime priority, plain priorities are used when the service
+     * is unavailable. JitterMeter measures how late a thread wakes compared to
+     * when it was due, which is what a bad schedule shows up as.
+     *=========================================================================*/
+    enum class ThreadRole
+    {
+        Ui,             // Message thread
+        Render,
+        Worker,         // Jobs the frame waits on
+        Background      // Jobs nothing waits on
+    };
+
+    struct ThreadPolicy
+    {
+        int nPriority = THREAD_PRIORITY_NORMAL;
+        LPCWSTR lpMmcssTask = nullptr;                  // MMCSS task name ("Games", "Pro Audio"...), nullptr for none
+        AVRT_PRIORITY mmcssPriority = AVRT_PRIORITY_NORMAL;
+        DWORD_PTR ullAffinity = 0;                      // Processor mask, 0 leaves it unchanged
+        int nIdealProcessor = -1;                       // -1 leaves it unchanged
+
+        // Defaults for the role, the render thread is registered as an MMCSS "Games" task
+        static ThreadPolicy ForRole(ThreadRole role);
+    };
+
+    class ThreadSchedule
+    {
+    private:
+        HANDLE m_hThread;
+        int m_nPreviousPriority;
+        DWORD_PTR m_ullPreviousAffinity = 0;
+        DWORD m_dwPreviousIdealProcessor = (DWORD)-1;
+        HANDLE m_hMmcss = NULL;
+        DWORD m_dwMmcssTask = 0;
+
+    public:
+        // Applies the policy to the calling thread, throws if the affinity or the priority can not be set
+        explicit ThreadSchedule(const ThreadPolicy& policy);
+        explicit ThreadSchedule(ThreadRole role) : ThreadSchedule(ThreadPolicy::ForRole(role)) {}
+        // Restores the previous priority, affinity and ideal processor, the destructor must run on the same thread
+        ~ThreadSchedule();
+
+        ThreadSchedule(const ThreadSchedule&) = delete;
+        ThreadSchedule& operator=(const ThreadSchedule&) = delete;
+
+        // FALSE when MMCSS was requested but unavailable and the plain priority was used instead
+        BOOL IsMmcss() const { return m_hMmcss != NULL; }
+    };
+
+    class JitterMeter
+    {
+    private:
+        static constexpr UINT s_uSamples = 128;
+
+        double m_dTicksToMs;
+        float m_fSamples[s_uSamples] = {};
+        UINT m_uCount = 0;
+        UINT m_uNext = 0;
+
+    public:
+        explicit JitterMeter(LONGLONG llFrequency) : m_dTicksToMs(1000.0 / (double)llFrequency) {}
+
+        // Records how late llActual is compared to llExpected, early wakes count as 0
+        void Record(LONGLONG llExpected, LONGLONG llActual);
+        void Reset() { m_uCount = 0; m_uNext = 0; }
+
+        // Statistics over the last 128 samples, in milliseconds
+        UINT GetCount() const { return m_uCount; }
+        float GetLast() const;
+        float GetMean() const;
+        float GetMax() const;
+        float GetPercentile(float fPercentile) const;
+    };
+
+    /*=========================================================================
+     * PreciseTimer definition
+     *
+     * Sleeps until a QueryPerformanceCounter deadline. Sleep rounds up to the
+     * system timer tick and overshoots by up to 15.6 ms, so a high resolution
+     * waitable timer wakes the thread slightly ahead of the deadline and the
+     * remainder is spun. The spin tail follows the measured wake-up lateness,
+     * staying short on an idle machine and growing when the scheduler is late.
+     *=========================================================================*/
+    class PreciseTimer
+    {
+    private:
+        HANDLE m_hTimer;
+        BOOL m_bHighResolution = TRUE;
+        LONGLONG m_llFrequency;
+        LONGLONG m_llArmed = 0;         // Wake-up the timer was set for, 0 when not armed
+        LONGLONG m_llMinSpinTail;
+        LONGLONG m_llMaxSpinTail;
+        LONGLONG m_llSpinTail;
+        double m_dLateMean;             // Moving mean and variance of the wake-up lateness, in ticks
+        double m_dLateVariance = 0.0;
+
+    public:
+        PreciseTimer();
+        ~PreciseTimer();
+
+        PreciseTimer(const PreciseTimer&) = delete;
+        PreciseTimer& operator=(const PreciseTimer&) = delete;
+
+        // Blocks the calling thread until the deadline, in QueryPerformanceCounter ticks
+        void SleepUntil(LONGLONG llDeadline);
+        void SleepFor(LONGLONG llTicks) { SleepUntil(QpcClock::Now() + llTicks); }
+
+        // Split form of SleepUntil for waiting on GetHandle alongside other objects. Arm returns FALSE
+        // when the deadline is within the spin tail, Finish is then called right away instead of
+        // after the handle was signaled
+        BOOL Arm(LONGLONG llDeadline);
+        void Finish(LONGLONG llDeadline);
+
+        HANDLE GetHandle() const { return m_hTimer; }
+        // FALSE before Windows 10 1803, the timer then being as coarse as the system tick
+        BOOL IsHighResolution() const { return m_bHighResolution; }
+        LONGLONG GetSpinTail() const { return m_llSpinTail; }
+    };
+
+    /*=========================================================================
+     * StartupTimeline definition
+     *
+     * Named marks taken while an application starts, kept in time order. An
+     * Application marks the process creation, the window class registration,
+     * the window creation and the first painted frame, before which its window
+     * stays cloaked. Asset loads and other steps are marked by the application.
+     *=========================================================================*/
+    class StartupTimeline
+    {
+    public:
+        struct Entry
+        {
+            std::wstring name;
+            LONGLONG llTicks;       // Since the timeline creation, negative before it
+        };
+
+    private:
+        LONGLONG m_llStart;
+        LONGLONG m_llFrequency;
+        std::vector<Entry> m_entries{};
+
+    public:
+        explicit StartupTimeline(LONGLONG llStart = QpcClock::Now(), LONGLONG llFrequency = QpcClock::GetFrequency())
+            : m_llStart(llStart), m_llFrequency(llFrequency) {}
+
+        // Timestamps are in QueryPerformanceCounter ticks
+        void Mark(LPCWSTR lpName) { Mark(lpName, QpcClock::Now()); }
+        void Mark(LPCWSTR lpName, LONGLONG llTimestamp);
+        // Marks when the process was created, before the C++ runtime and the static constructors ran
+        void MarkProcessStart();
+
+        const std::vector<Entry>& GetEntries() const { return m_entries; }
+        double GetMilliseconds(const Entry& entry) const { return (double)entry.llTicks * 1000.0 / (double)m_llFrequency; }
+        // One line per mark with the time since the timeline creation and since the previous mark
+        std::wstring Format() const;
+    };
+
     /*=========================================================================
      * Application definition
      *=========================================================================*/
-    template<class DerivedType>
+    template<class DerivedType, class ClockType = QpcClock>
     class Application
     {
     protected:
+        StartupTimeline m_startupTimeline{};
+        BOOL m_bCloaked = FALSE;
+        BOOL m_bFirstFrameShown = FALSE;
         HINSTANCE m_hInstance;
         HWND m_hWnd;
+        BOOL m_bFrameRequested = FALSE;
+        PreciseTimer m_frameTimer{};
+        LONGLONG m_llFrameInterval = 0;
+        LONGLONG m_llFrameDeadline = 0;
+        MetricsPublisher m_metrics{};
+        JitterMeter m_jitterMeter{ QpcClock::GetFrequency() };
+        BOOL m_bJitterMeter = FALSE;
+        MSG m_dispatched{};
+        EventTime m_eventTime{};
+        PointerPredictor m_pointerPredictor{ ClockType::GetFrequency() };
+        BOOL m_bPointerPrediction = FALSE;
+        PointerContacts m_pointerContacts{};
+        std::vector<PointerSample> m_pointerSamples{};
+        std::vector<POINTER_INFO> m_pointerHistory{};
+        std::vector<POINTER_PEN_INFO> m_penHistory{};
+        std::vector<POINTER_TOUCH_INFO> m_touchHistory{};
+
+        void Dispatch(const MSG& msg);
+        void EndPump(UINT32 uMessages);
+        void WaitFrameDeadline();
+        static LONGLONG QpcToClock(LONGLONG llQpc);
+        void AddPointerSample(const POINTER_INFO& info, float fPressure, float fTiltX, float fTiltY, float fRotation,
+            UINT32 uPenFlags);
+        BOOL HandlePointer(UINT32 uPointerId);
 
     public:
+        // The window is shown cloaked and revealed once its first WM_PAINT was handled
         Application(PCWSTR lpWindowName,
             int nWidth = CW_USEDEFAULT,
             int nHeight = CW_USEDEFAULT,
@@ -77,6 +698,47 @@ namespace SWL
         void WaitMessage();
         void PollMessage();
 
+        // Waits for messages or for one of the handles to be signaled, returns the index of the
+        // signaled handle, nCount once the pending messages were dispatched or WAIT_TIMEOUT
+        DWORD WaitMessageOrObjects(const HANDLE* pHandles, DWORD nCount, DWORD dwMilliseconds = INFINITE);
+
+        // Frame loop functions, RunFrame dispatches the pending messages then renders a frame paced
+        // on the compositor if one was requested, otherwise it sleeps until the next message
+        void RequestFrame() { m_bFrameRequested = TRUE; }
+        void RunFrame();
+        // Paces RunFrame on a PreciseTimer at a fixed rate instead of the compositor, messages being
+        // dispatched during the wait. 0 returns to the compositor pacing
+        void SetFrameRate(double dFramesPerSecond);
+        PreciseTimer& GetFrameTimer() { return m_frameTimer; }
+        // Retrieves the next vertical blank and the refresh period in QueryPerformanceCounter ticks
+        BOOL GetCompositionTiming(LONGLONG* pllNextVBlank, LONGLONG* pllRefreshPeriod) const;
+
+        // Publishes dispatch and frame metrics under lpName for MetricsReader, nothing is measured until then
+        void EnableMetrics(LPCWSTR lpName) { m_metrics.Create(lpName); }
+        MetricsPublisher& GetMetrics() { return m_metrics; }
+
+        // Measures each frame how late the thread wakes from DwmFlush after the vertical blank,
+        // to check the ThreadSchedule of the frame loop thread
+        void EnableJitterMeter() { m_bJitterMeter = TRUE; }
+        const JitterMeter& GetJitterMeter() const { return m_jitterMeter; }
+
+        // Timing of the message being handled, valid inside the message handlers. Messages sent
+        // directly to the window instead of being queued are stamped when they reach WndProc
+        const EventTime& GetEventTime() const { return m_eventTime; }
+
+        // Feeds WM_MOUSEMOVE to the pointer predictor, OnMouseMove still receiving the raw coordinates
+        void EnablePointerPrediction() { m_bPointerPrediction = TRUE; }
+        PointerPredictor& GetPointerPredictor() { return m_pointerPredictor; }
+        // Pointer position predicted for when the frame rendered now is displayed
+        BOOL GetPredictedPointer(float* px, float* py) const;
+
+        // Pen and touch contacts currently down, updated before OnPointer is called
+        const PointerContacts& GetPointerContacts() const { return m_pointerContacts; }
+
+        // Startup marks, the last one being "First frame" once the window was revealed
+        StartupTimeline& GetStartupTimeline() { return m_startupTimeline; }
+        BOOL IsFirstFrameShown() const { return m_bFirstFrameShown; }
+
     protected:
         // Message handling functions to be overrided
         virtual void OnPaint(HDC hDC, PAINTSTRUCT ps) {}
@@ -85,141 +747,6334 @@ namespace SWL
         virtual void OnMouseButtonDown(UINT uButton) {}
         virtual void OnMouseButtonUp(UINT uButton) {}
         virtual void OnMouseMove(int x, int y) {}
+        // Samples of a single pointer in chronological order, returning FALSE lets Windows emulate the mouse
+        virtual BOOL OnPointer(const PointerSample* pSamples, UINT uCount) { return FALSE; }
+        // Posted by a GamepadPoller created for this window
+        virtual void OnGamepadButtons(UINT uPad, WORD wPressed, WORD wReleased) {}
+        virtual void OnGamepadConnection(UINT uPad, BOOL bConnected) {}
         virtual void OnClose() {}
         virtual BOOL HandleOtherMessages(UINT uMsg) { return FALSE; }
 
+        // Called once per pump, after the retrieved message has been dispatched
+        virtual void OnPump() {}
+
     };
-}
 
-#ifdef SWL_IMPLEMENTATION
-namespace SWL
-{
     /*=========================================================================
-     * ApplicationException implementation
+     * EventBus definition
+     *
+     * Event types are fixed at compile time through the template parameter
+     * list. Each type owns a contiguous array of subscribers, so publishing is
+     * a plain loop without any hashing or RTTI. Events posted with Post are
+     * queued and delivered by Flush, typically called from OnPump.
      *=========================================================================*/
-    ApplicationException::ApplicationException(LPCWSTR lpInfo)
+    template<class... EventTypes>
+    class EventBus
     {
-        m_info = {};
-        m_info += lpInfo;
-        m_info += L" | Error code : ";
-        m_info += std::to_wstring(GetLastError());
-    }
+    private:
+        template<class EventType>
+        struct Subscriber
+        {
+            void* pContext;
+            void (*pfnHandler)(void*, const EventType&);
+        };
 
-    void ApplicationException::ShowMessageBox() { MessageBoxW(NULL, m_info.c_str(), NULL, MB_ICONERROR); }
+        template<class EventType>
+        struct Channel
+        {
+            std::vector<Subscriber<EventType>> subscribers{};
+            std::vector<EventType> deferred{};
+            std::vector<EventType> delivering{};
+            UINT uPublishing = 0;           // Nested Publish calls in progress
+            BOOL bRemoved = FALSE;          // Subscribers unsubscribed while publishing, compacted afterwards
+        };
 
-    void ApplicationException::ShowDebugOutput() { OutputDebugStringW(m_info.c_str()); }
+        template<class MethodType>
+        struct MethodTraits;
+
+        template<class ObjectType, class EventType>
+        struct MethodTraits<void (ObjectType::*)(const EventType&)>
+        {
+            using Object = ObjectType;
+            using Event = EventType;
+        };
+
+        template<auto pfnMethod>
+        static void InvokeMethod(void* pContext, const typename MethodTraits<decltype(pfnMethod)>::Event& event);
+
+        template<class EventType>
+        Channel<EventType>& GetChannel();
+
+        template<class EventType>
+        void FlushChannel();
+        template<class EventType>
+        void EndPublish(Channel<EventType>& channel);
+
+        std::tuple<Channel<EventTypes>...> m_channels{};
+        BOOL m_bFlushing = FALSE;
+
+    public:
+        // Subscription functions, handlers are called in subscription order
+        template<class EventType>
+        void Subscribe(void (*pfnHandler)(void*, const EventType&), void* pContext = nullptr);
+        template<auto pfnMethod>
+        void Subscribe(typename MethodTraits<decltype(pfnMethod)>::Object* pObject);
+        template<class EventType>
+        void Unsubscribe(void (*pfnHandler)(void*, const EventType&), void* pContext = nullptr);
+        template<auto pfnMethod>
+        void Unsubscribe(typename MethodTraits<decltype(pfnMethod)>::Object* pObject);
+
+        // Delivery functions
+        template<class EventType>
+        void Publish(const EventType& event);
+        template<class EventType>
+        void Post(EventType event);
+        void Flush();
+    };
 
     /*=========================================================================
-     * Application implementation
+     * SharedRing definition
+     *
+     * Lock-free single producer/single consumer ring of fixed-size slots living
+     * in a named file mapping, so another process can feed an Application. The
+     * consuming side creates the ring and waits on GetWaitHandle (for example
+     * through WaitMessageOrObjects), the producing side opens it by name. Slots
+     * are read in place, Peek returning every contiguous readable slot at once.
      *=========================================================================*/
-    template<class DerivedType>
-    Application<DerivedType>::Application(PCWSTR lpWindowName, int nWidth, int nHeight, int x, int y,
-        DWORD dwStyle, DWORD dwExStyle)
+    class SharedRing
     {
-        m_hInstance = GetModuleHandleW(NULL);
+    private:
+        struct Header
+        {
+            UINT32 uMagic;
+            UINT32 uSlotSize;
+            UINT32 uSlotCount;
+            alignas(64) std::atomic<UINT64> ulHead;
+            alignas(64) std::atomic<UINT64> ulTail;
+        };
 
-        WNDCLASS wndClass = {};
-        wndClass.lpfnWndProc = DerivedType::WndProc;
-        wndClass.hInstance = m_hInstance;
-        wndClass.lpszClassName = lpWindowName;
-        if (!RegisterClassW(&wndClass))
-            throw ApplicationException(L"Failed to register the window class (RegisterClassW)");
+        static_assert(std::atomic<UINT64>::is_always_lock_free, "SharedRing requires lock-free 64-bit atomics");
+        static constexpr UINT32 s_uMagic = 0x47525753; // 'SWRG'
 
+        HANDLE m_hMapping = NULL;
+        HANDLE m_hEvent = NULL;
+        Header* m_pHeader = nullptr;
+        BYTE* m_pSlots = nullptr;
+        UINT64 m_ulPending = 0;
 
-        m_hWnd = CreateWindowExW(dwExStyle, lpWindowName, lpWindowName, dwStyle, x, y,
-            nWidth, nHeight, NULL, NULL, m_hInstance, this);
-        if (m_hWnd == nullptr)
-            throw ApplicationException(L"Failed to create a window (CreateWindowEx)");
+        void OpenEvent(LPCWSTR lpName, BOOL bCreate);
 
-        ShowWindow(m_hWnd, SW_SHOW);
-    }
+    public:
+        // Creates the ring, uSlotCount must be a power of two
+        SharedRing(LPCWSTR lpName, UINT uSlotSize, UINT uSlotCount);
+        // Opens a ring created by another process
+        SharedRing(LPCWSTR lpName);
+        ~SharedRing();
 
-    template<class DerivedType>
-    LRESULT CALLBACK Application<DerivedType>::WndProc(HWND hWnd, UINT uMsg, WPARAM wParam, LPARAM lParam)
-    {
-        DerivedType* pDerivedType = NULL;
+        SharedRing(const SharedRing&) = delete;
+        SharedRing& operator=(const SharedRing&) = delete;
 
-        if (uMsg == WM_NCCREATE)
-        {
-            CREATESTRUCT* pCreate = (CREATESTRUCT*)lParam;
-            pDerivedType = (DerivedType*)pCreate->lpCreateParams;
-            SetWindowLongPtr(hWnd, GWLP_USERDATA, (LONG_PTR)pDerivedType);
+        UINT GetSlotSize() const { return m_pHeader->uSlotSize; }
+        UINT GetSlotCount() const { return m_pHeader->uSlotCount; }
 
-            pDerivedType->m_hWnd = hWnd;
-        }
-        else
-        {
-            pDerivedType = (DerivedType*)GetWindowLongPtr(hWnd, GWLP_USERDATA);
-        }
+        // Producer functions, AcquireSlot returns nullptr when the ring is full
+        void* AcquireSlot();
+        void CommitSlot();
 
-        if (pDerivedType)
+        // Consumer functions, keep calling Peek until it returns 0 before waiting again
+        HANDLE GetWaitHandle() const { return m_hEvent; }
+        UINT Peek(const void** ppSlots);
+        void Release(UINT uCount);
+    };
+
+    /*=========================================================================
+     * SharedFramebuffer definition
+     *
+     * Triple buffered 32-bit framebuffer living in a named file mapping, used
+     * to let a child process render a panel that the host composites without
+     * copying pixels across processes. The host creates the framebuffer and
+     * the child opens it by name. Each buffer is exposed as a DIB section
+     * built directly over the mapping, so both sides can use GDI on it.
+     *
+     * The child renders into the back buffer and calls Present, which swaps it
+     * with the shared middle buffer and stamps it with an increasing sequence
+     * number. The host calls Acquire to swap its front buffer with the middle
+     * one whenever a new frame was presented, then Composite to draw it.
+     *=========================================================================*/
+    class SharedFramebuffer
+    {
+    private:
+        struct Header
         {
-            switch (uMsg)
-            {
+            UINT32 uMagic;
+            UINT32 uWidth;
+            UINT32 uHeight;
+            UINT32 uBufferSize;
+            UINT64 ulBufferSequence[3];
+            alignas(64) std::atomic<UINT32> uMiddle;
+            alignas(64) std::atomic<UINT64> ulSequence;
+        };
+
+        static constexpr UINT32 s_uMagic = 0x42465753; // 'SWFB'
+        static constexpr UINT32 s_uDirty = 0x4;
+        static constexpr UINT32 s_uHeaderSize = 4096;
+
+        HANDLE m_hMapping = NULL;
+        HANDLE m_hEvent = NULL;
+        Header* m_pHeader = nullptr;
+        HDC m_hDCs[3] = {};
+        HBITMAP m_hBitmaps[3] = {};
+        HGDIOBJ m_hOldBitmaps[3] = {};
+        void* m_pPixels[3] = {};
+        UINT32 m_uIndex = 0;
+
+        void CreateBuffers(LPCWSTR lpName, BOOL bCreate);
+        void DestroyBuffers();
+
+    public:
+        // Creates the framebuffer (host side)
+        SharedFramebuffer(LPCWSTR lpName, int nWidth, int nHeight);
+        // Opens a framebuffer created by the host (renderer side)
+        SharedFramebuffer(LPCWSTR lpName);
+        ~SharedFramebuffer();
+
+        SharedFramebuffer(const SharedFramebuffer&) = delete;
+        SharedFramebuffer& operator=(const SharedFramebuffer&) = delete;
+
+        int GetWidth() const { return (int)m_pHeader->uWidth; }
+        int GetHeight() const { return (int)m_pHeader->uHeight; }
+        UINT64 GetPresentedSequence() const { return m_pHeader->ulSequence.load(); }
+
+        // Renderer side functions
+        HDC GetBackDC() const { return m_hDCs[m_uIndex]; }
+        UINT32* GetBackPixels() const { return (UINT32*)m_pPixels[m_uIndex]; }
+        void Present();
+
+        // Host side functions, Acquire returns FALSE when no new frame was presented
+        HANDLE GetWaitHandle() const { return m_hEvent; }
+        BOOL Acquire();
+        UINT64 GetFrontSequence() const { return m_pHeader->ulBufferSequence[m_uIndex]; }
+        const UINT32* GetFrontPixels() const { return (const UINT32*)m_pPixels[m_uIndex]; }
+        void Composite(HDC hDC, int x, int y) const;
+    };
+
+    /*=========================================================================
+     * PngEncoder definition
+     *
+     * Writes surfaces as 8-bit RGB or RGBA PNG files. Rows are filtered with
+     * SSE2 (the filter with the lowest sum of absolute differences is picked
+     * per row) and the image is split in row ranges deflated in parallel. Each
+     * range ends with a sync flush so the streams can simply be concatenated,
+     * and they are written to the file as separate IDAT chunks in order as
+     * soon as they are ready.
+     *=========================================================================*/
+    class PngEncoder
+    {
+    private:
+        struct Block
+        {
+            std::vector<BYTE> data{};
+            UINT32 uAdler = 1;
+            SIZE_T size = 0;
+        };
+
+        UINT m_uThreadCount;
+
+        static UINT32 Crc32(UINT32 uCrc, const BYTE* pData, SIZE_T size);
+        static UINT32 Adler32(UINT32 uAdler, const BYTE* pData, SIZE_T size);
+        static UINT32 CombineAdler32(UINT32 uAdler1, UINT32 uAdler2, SIZE_T size2);
+        static void Deflate(const BYTE* pData, SIZE_T size, BOOL bFinal, std::vector<BYTE>& out);
+        static void FilterRow(const BYTE* pRow, const BYTE* pPrior, SIZE_T rowSize, int nBpp,
+            BYTE* pScratch, BYTE* pOut);
+        static void ConvertRow(const UINT32* pPixels, int nWidth, BOOL bAlpha, BYTE* pOut);
+        static void WriteChunk(HANDLE hFile, const char* pType, const BYTE* pData, SIZE_T size);
+
+    public:
+        // 0 uses one thread per hardware thread
+        PngEncoder(UINT uThreadCount = 0);
+
+        // Surfaces are BGRA, with bAlpha FALSE the alpha channel is dropped as GDI leaves it undefined
+        void Save(LPCWSTR lpFileName, const Surface& surface, BOOL bAlpha = FALSE);
+    };
+
+    /*=========================================================================
+     * Drawing functions definition
+     *
+     * Pixels are premultiplied BGRA. Composition functions clip against the
+     * destination surface and blend with the source over operator, either on
+     * the sRGB encoded values or in linear light. Linear blending goes through
+     * lookup tables with a 12-bit linear intermediate instead of calling pow.
+     *=========================================================================*/
+    enum class BlendMode
+    {
+        Srgb,
+        Linear,
+    };
+
+    // Blends uCount source pixels over the destination pixels
+    void BlendRowOver(UINT32* pDst, const UINT32* pSrc, int nCount, BlendMode mode = BlendMode::Srgb);
+    // Composites the whole source surface at (x, y)
+    void CompositeOver(const Surface& dst, int x, int y, const Surface& src, BlendMode mode = BlendMode::Srgb);
+    // Composites the rcSrc area of the source stretched to rcDst with nearest sampling
+    void CompositeScaled(const Surface& dst, const RECT& rcDst, const Surface& src, const RECT& rcSrc,
+        BlendMode mode = BlendMode::Srgb);
+    // Composites the source stretched to rcDst keeping the rcInsets borders unscaled
+    void CompositeNineSlice(const Surface& dst, const RECT& rcDst, const Surface& src, const RECT& rcInsets,
+        BlendMode mode = BlendMode::Srgb);
+    // Composites uColor through an 8-bit coverage mask placed at (x, y)
+    void FillMask(const Surface& dst, int x, int y, const BYTE* pMask, int nWidth, int nHeight, int nStride,
+        UINT32 uColor, BlendMode mode = BlendMode::Srgb);
+    // Approximates a gaussian blur in place with nPasses box blurs, edges being clamped
+    void BoxBlur(const Surface& surface, int nRadius, int nPasses = 3);
+
+    /*=========================================================================
+     * ShadowCache definition
+     *
+     * Drop shadows of rectangles, blurred once per size and radius. Only a
+     * rectangle just large enough for the blurred edges to meet is rendered,
+     * larger shapes reusing it as a nine-slice so resizing never blurs again.
+     * Only the most recently used shadows are kept.
+     *=========================================================================*/
+    class ShadowCache
+    {
+    private:
+        struct Key
+        {
+            int nWidth;
+            int nHeight;
+            int nRadius;
+            UINT32 uColor;
+
+            bool operator==(const Key& other) const
+            {
+                return std::tie(nWidth, nHeight, nRadius, uColor)
+                    == std::tie(other.nWidth, other.nHeight, other.nRadius, other.uColor);
+            }
+        };
+
+        struct Entry
+        {
+            Key key;
+            Image image;
+        };
+
+        SIZE_T m_maxEntries;
+        std::list<Entry> m_entries{};
+
+        const Image& GetShadow(const Key& key);
+
+    public:
+        ShadowCache(SIZE_T maxEntries = 32);
+
+        // Draws the shadow of rcShape, uColor being premultiplied and nRadius the blur radius
+        void Draw(const Surface& dst, const RECT& rcShape, int nRadius, UINT32 uColor, BlendMode mode = BlendMode::Srgb);
+        void Clear() { m_entries.clear(); }
+    };
+
+    /*=========================================================================
+     * NineSliceImage definition
+     *
+     * Nine-slice drawing of a source surface remembering the composed result
+     * for the most recently used target sizes. A size is only cached once it
+     * was requested twice in a row, so sizes that keep changing (animations)
+     * are drawn slice by slice instead of filling the cache.
+     *=========================================================================*/
+    class NineSliceImage
+    {
+    private:
+        struct Entry
+        {
+            int nWidth;
+            int nHeight;
+            Image image;
+        };
+
+        Surface m_source{};
+        RECT m_rcInsets{};
+        SIZE_T m_maxEntries;
+        std::list<Entry> m_entries{};
+        int m_nLastWidth = 0;
+        int m_nLastHeight = 0;
+
+    public:
+        // The source surface has to outlive the NineSliceImage
+        NineSliceImage(const Surface& source, const RECT& rcInsets, SIZE_T maxEntries = 8);
+
+        void Draw(const Surface& dst, const RECT& rcDst, BlendMode mode = BlendMode::Srgb);
+        void Clear() { m_entries.clear(); }
+    };
+
+    /*=========================================================================
+     * Path definition
+     *
+     * Contours flattened into line segments when they are built, curves being
+     * subdivided until they deviate less than the tolerance from the curve.
+     *=========================================================================*/
+    class Path
+    {
+    public:
+        struct Point
+        {
+            float x;
+            float y;
+        };
+
+        struct Contour
+        {
+            UINT32 uEnd;
+            BOOL bClosed;
+        };
+
+    private:
+        std::vector<Point> m_points{};
+        std::vector<Contour> m_contours{};
+        float m_fTolerance;
+        Point m_current{};
+        BOOL m_bOpen = FALSE;
+
+        void AddPolygon(const Point* pPoints, int nCount);
+
+    public:
+        Path(float fTolerance = 0.25f);
+
+        void MoveTo(float x, float y);
+        void LineTo(float x, float y);
+        void QuadTo(float cx, float cy, float x, float y);
+        void CubicTo(float cx1, float cy1, float cx2, float cy2, float x, float y);
+        void Close();
+
+        // Outline of the path stroked with round joins and caps, to be filled like any other path
+        Path Stroke(float fWidth) const;
+
+        BOOL IsEmpty() const { return m_points.empty(); }
+        Point GetCurrentPoint() const { return m_current; }
+        const std::vector<Point>& GetPoints() const { return m_points; }
+        const std::vector<Contour>& GetContours() const { return m_contours; }
+    };
+
+    /*=========================================================================
+     * Rasterizer definition
+     *
+     * Anti-aliased coverage rasterizer accumulating the signed area covered by
+     * each edge in every cell, coverage being the clamped absolute value of the
+     * running sum along each row (non-zero filling of overlapping contours).
+     *=========================================================================*/
+    class Rasterizer
+    {
+    private:
+        int m_nWidth = 0;
+        int m_nHeight = 0;
+        std::vector<float> m_cells{};
+
+    public:
+        void Reset(int nWidth, int nHeight);
+        void AddLine(float x0, float y0, float x1, float y1);
+        // Adds every contour of the path, closing them, mapped with x * fScaleX + fOffsetX
+        void AddPath(const Path& path, float fScaleX, float fScaleY, float fOffsetX, float fOffsetY);
+        // Writes 8-bit coverage and clears the cells for the next shape
+        void Resolve(BYTE* pCoverage, int nStride);
+    };
+
+    /*=========================================================================
+     * SvgIcon definition
+     *
+     * Practical subset of SVG: path, rect, circle, ellipse, line, polyline and
+     * polygon elements inside svg/g groups, with fill, stroke, stroke-width,
+     * opacity and transform attributes (or the same properties in style).
+     * Shapes are flattened once at load time in viewBox units, rendering only
+     * scales them to the requested size.
+     *=========================================================================*/
+    class SvgIcon
+    {
+    private:
+        struct Matrix
+        {
+            float a = 1, b = 0, c = 0, d = 1, e = 0, f = 0;
+
+            Matrix operator*(const Matrix& other) const;
+            Path::Point Apply(float x, float y) const { return { a * x + c * y + e, b * x + d * y + f }; }
+        };
+
+        struct Style
+        {
+            Matrix transform{};
+            UINT32 uFill = 0xFF000000;
+            UINT32 uStroke = 0;
+            BOOL bFill = TRUE;
+            BOOL bStroke = FALSE;
+            float fStrokeWidth = 1.0f;
+            float fOpacity = 1.0f;
+            float fFillOpacity = 1.0f;
+            float fStrokeOpacity = 1.0f;
+        };
+
+        struct Shape
+        {
+            Path fill;
+            Path stroke;
+            UINT32 uFill;
+            UINT32 uStroke;
+        };
+
+        std::vector<Shape> m_shapes{};
+        UINT64 m_ulId;
+        float m_fViewX = 0;
+        float m_fViewY = 0;
+        float m_fViewWidth = 0;
+        float m_fViewHeight = 0;
+        float m_fTolerance = 0.05f;
+
+        void Parse(const char* pSource, SIZE_T size);
+        void ParseAttribute(Style& style, const std::string& name, const std::string& value);
+        void ParsePathData(Path& path, const Matrix& transform, const std::string& data);
+        void AddShape(const Style& style, const std::string& element, const std::map<std::string, std::string>& attributes);
+
+    public:
+        SvgIcon(const char* pSource, SIZE_T size);
+        SvgIcon(LPCWSTR lpFileName);
+
+        float GetViewWidth() const { return m_fViewWidth; }
+        float GetViewHeight() const { return m_fViewHeight; }
+        // Unique for each loaded icon, copies sharing the identifier of their source
+        UINT64 GetId() const { return m_ulId; }
+
+        // Renders the icon fitted and centered in the image, which is cleared first
+        void Render(Image& image, Rasterizer& rasterizer) const;
+    };
+
+    /*=========================================================================
+     * ShelfPacker definition
+     *
+     * Packs rectangles in rows (shelves) of an atlas, each one going to the
+     * lowest shelf tall enough for it or to a new shelf below the last one.
+     *=========================================================================*/
+    class ShelfPacker
+    {
+    private:
+        struct Shelf
+        {
+            int nTop;
+            int nHeight;
+            int nCursor;
+        };
+
+        int m_nWidth;
+        int m_nHeight;
+        std::vector<Shelf> m_shelves{};
+
+    public:
+        ShelfPacker(int nWidth, int nHeight) : m_nWidth(nWidth), m_nHeight(nHeight) {}
+
+        BOOL Allocate(int nWidth, int nHeight, RECT& rcEntry);
+        void Clear() { m_shelves.clear(); }
+    };
+
+    /*=========================================================================
+     * IconAtlas definition
+     *
+     * Rasterizes icons on demand for each pixel size (logical size scaled by
+     * the DPI) and keeps them packed in shelves of a single atlas image. The
+     * atlas starts over when an icon no longer fits.
+     *=========================================================================*/
+    class IconAtlas
+    {
+    private:
+        // Icons are told apart by identifier, a new icon at the address of a destroyed one is another entry
+        struct Key
+        {
+            UINT64 ulIcon;
+            int nSize;
+
+            bool operator<(const Key& other) const { return std::tie(ulIcon, nSize) < std::tie(other.ulIcon, other.nSize); }
+        };
+
+        Image m_atlas;
+        Image m_scratch{};
+        Rasterizer m_rasterizer{};
+        ShelfPacker m_packer;
+        std::map<Key, RECT> m_entries{};
+
+    public:
+        IconAtlas(int nWidth = 1024, int nHeight = 1024);
+
+        void Draw(const Surface& dst, int x, int y, const SvgIcon& icon, int nSize, UINT uDpi = 96,
+            BlendMode mode = BlendMode::Srgb);
+        void Clear();
+    };
+
+    /*=========================================================================
+     * Font definition
+     *
+     * TrueType font mapped read-only from its file. Tables are read in place,
+     * cmap, loca, glyf and hmtx being located the first time they are needed.
+     * Outlines (simple and composite glyphs) are flattened with Path and
+     * rasterized with Rasterizer, the coverage masks being cached per glyph
+     * and pixel size.
+     *=========================================================================*/
+    class Font
+    {
+    public:
+        struct Glyph
+        {
+            std::vector<BYTE> coverage;
+            int nLeft;   // From the pen position
+            int nTop;    // From the baseline, negative above it
+            int nWidth;
+            int nHeight;
+            float fAdvance;
+        };
+
+    private:
+        HANDLE m_hFile = INVALID_HANDLE_VALUE;
+        HANDLE m_hMapping = NULL;
+        const BYTE* m_pData = nullptr;
+        SIZE_T m_size = 0;
+
+        int m_nUnitsPerEm = 0;
+        int m_nAscender = 0;
+        int m_nDescender = 0;
+        int m_nLineGap = 0;
+        UINT32 m_uGlyphCount = 0;
+        UINT32 m_uMetricCount = 0;
+        BOOL m_bLongOffsets = FALSE;
+
+        // Tables resolved on first use
+        BOOL m_bCmapResolved = FALSE;
+        const BYTE* m_pCmap = nullptr;
+        UINT32 m_uCmapLength = 0;
+        BOOL m_bOutlinesResolved = FALSE;
+        const BYTE* m_pLoca = nullptr;
+        UINT32 m_uLocaLength = 0;
+        const BYTE* m_pGlyf = nullptr;
+        UINT32 m_uGlyfLength = 0;
+        const BYTE* m_pHmtx = nullptr;
+        UINT32 m_uHmtxLength = 0;
+
+        std::map<std::pair<UINT32, int>, Glyph> m_glyphs{};
+        Rasterizer m_rasterizer{};
+
+        const BYTE* FindTable(UINT32 uTag, UINT32* puLength) const;
+        BOOL ParseHeader();
+        void ResolveCmap();
+        void ResolveOutlines();
+        void AppendOutline(Path& path, UINT32 uGlyph, const float* pMatrix, int nDepth);
+
+    public:
+        Font(LPCWSTR lpFileName);
+        ~Font();
+
+        Font(const Font&) = delete;
+        Font& operator=(const Font&) = delete;
+
+        float GetAscent(float fPixelSize) const { return m_nAscender * fPixelSize / m_nUnitsPerEm; }
+        float GetDescent(float fPixelSize) const { return -m_nDescender * fPixelSize / m_nUnitsPerEm; }
+        float GetLineHeight(float fPixelSize) const { return (m_nAscender - m_nDescender + m_nLineGap) * fPixelSize / m_nUnitsPerEm; }
+        UINT32 GetGlyphCount() const { return m_uGlyphCount; }
+
+        // Glyph 0 (.notdef) for code points missing from the font
+        UINT32 GetGlyphIndex(UINT32 uCodepoint);
+        float GetAdvance(UINT32 uGlyph, float fPixelSize);
+        // Outline in pixels for an em of fPixelSize, y down with the origin on the baseline
+        void GetOutline(UINT32 uGlyph, float fPixelSize, Path& path);
+
+        const Glyph& GetGlyph(UINT32 uGlyph, int nPixelSize);
+        void ClearCache() { m_glyphs.clear(); }
+
+        // Draws UTF-16 text from the pen position x on the baseline y, returns the pen position after it
+        float DrawString(const Surface& dst, float x, float y, const wchar_t* pText, SIZE_T length, int nPixelSize,
+            UINT32 uColor, BlendMode mode = BlendMode::Srgb);
+    };
+
+    /*=========================================================================
+     * SdfFont definition
+     *
+     * Signed distance fields of the glyphs of a font, generated once at a base
+     * size and packed in a single-channel atlas. Text of any size is drawn by
+     * sampling the fields bilinearly, so edges stay sharp at every scale with
+     * a single entry per glyph. Glyphs missing from the atlas are generated in
+     * parallel before a string is drawn.
+     *=========================================================================*/
+    class SdfFont
+    {
+    private:
+        struct Entry
+        {
+            RECT rcAtlas;
+            int nLeft;   // From the pen position at the base size
+            int nTop;    // From the baseline at the base size
+        };
+
+        struct Job
+        {
+            UINT32 uGlyph;
+            Path outline;
+            int nLeft;
+            int nTop;
+            int nWidth;
+            int nHeight;
+            std::vector<BYTE> field;
+        };
+
+        Font& m_font;
+        int m_nBaseSize;
+        int m_nSpread;
+        UINT m_uThreadCount;
+        int m_nAtlasWidth;
+        int m_nAtlasHeight;
+        std::vector<BYTE> m_atlas;
+        ShelfPacker m_packer;
+        std::map<UINT32, Entry> m_entries{};
+        std::vector<BYTE> m_coverage{};
+
+        void Generate(Job& job, Rasterizer& rasterizer) const;
+        BOOL PrepareGlyphs(const wchar_t* pText, SIZE_T length);
+
+    public:
+        // Fields are 8-bit, nSpread being the distance in base size pixels covered on each side of the edges
+        SdfFont(Font& font, int nBaseSize = 32, int nSpread = 4, int nAtlasWidth = 1024, int nAtlasHeight = 1024,
+            UINT uThreadCount = 0);
+
+        // Generates the missing glyphs of the text, starting over with an empty atlas when it is full
+        void Prepare(const wchar_t* pText, SIZE_T length);
+        void Clear();
+
+        float DrawString(const Surface& dst, float x, float y, const wchar_t* pText, SIZE_T length, float fPixelSize,
+            UINT32 uColor, BlendMode mode = BlendMode::Srgb);
+    };
+
+    /*=========================================================================
+     * FormatBuffer definition
+     *
+     * Fixed capacity wide string formatted in place, for counters and readouts
+     * rebuilt every frame without any allocation. Numbers go through
+     * std::to_chars (shortest round-trip representation for floating point
+     * values), and text past the capacity is truncated.
+     *=========================================================================*/
+    template<SIZE_T Capacity>
+    class FormatBuffer
+    {
+    private:
+        wchar_t m_text[Capacity + 1];
+        SIZE_T m_length = 0;
+
+        FormatBuffer& AppendChars(const char* pFirst, const char* pLast);
+
+    public:
+        FormatBuffer() { m_text[0] = L'\0'; }
+
+        FormatBuffer& Clear();
+        FormatBuffer& Append(const wchar_t* pText);
+        FormatBuffer& Append(const wchar_t* pText, SIZE_T length);
+        FormatBuffer& Append(wchar_t c);
+        // Narrow characters are appended as Latin-1 characters, not as numbers
+        FormatBuffer& Append(char c);
+        FormatBuffer& Append(bool bValue);
+        FormatBuffer& Append(float fValue);
+        FormatBuffer& Append(double dValue);
+
+        template<class T, std::enable_if_t<std::is_integral_v<T> && !std::is_same_v<T, wchar_t>
+            && !std::is_same_v<T, char> && !std::is_same_v<T, bool>, int> = 0>
+        FormatBuffer& Append(T value);
+
+        // Integer right aligned on at least nWidth characters
+        template<class T, std::enable_if_t<std::is_integral_v<T> && !std::is_same_v<T, bool>, int> = 0>
+        FormatBuffer& AppendPadded(T value, int nWidth, wchar_t cFill = L' ');
+
+        FormatBuffer& AppendFixed(double dValue, int nDecimals);
+        // Three significant digits in ns, us, ms or s depending on the magnitude
+        FormatBuffer& AppendDuration(double dSeconds);
+
+        template<class T>
+        FormatBuffer& operator<<(const T& value) { return Append(value); }
+
+        const wchar_t* GetText() const { return m_text; }
+        SIZE_T GetLength() const { return m_length; }
+        BOOL IsFull() const { return m_length == Capacity; }
+    };
+
+    /*=========================================================================
+     * Logger definition
+     *
+     * Asynchronous logger cheap enough to be called from message handlers.
+     * Log copies the format string pointer and its arguments into a fixed-size
+     * record of a single producer ring owned by the calling thread, without
+     * locking or allocating once the thread has logged for the first time. A
+     * background thread formats the records, "{}" being replaced by the next
+     * argument, and writes them to a UTF-8 file or to the debugger. Records
+     * are dropped (and counted) rather than blocking when a ring is full.
+     * The ring of a thread that exited is reused once it has been drained.
+     *
+     * Format strings are kept as pointers, so they must outlive the logger
+     * (string literals). String arguments are copied into the record, up to
+     * 128 characters in total, longer ones being truncated.
+     *=========================================================================*/
+    class Logger
+    {
+    private:
+        static constexpr UINT s_uMaxArguments = 6;
+        static constexpr UINT s_uRecordCount = 1024;
+        static constexpr UINT s_uStringCapacity = 128;
+
+        struct Argument
+        {
+            enum class Type : UINT32
+            {
+                Signed,
+                Unsigned,
+                Float,
+                String
+            } type;
+
+            union
+            {
+                LONGLONG llSigned;
+                ULONGLONG ullUnsigned;
+                double dFloat;
+                struct
+                {
+                    UINT32 uOffset;     // In Record::strings
+                    UINT32 uLength;
+                } string;
+            };
+        };
+
+        struct Record
+        {
+            const wchar_t* pFormat;
+            LONGLONG llTimestamp;
+            UINT32 uArgumentCount;
+            UINT32 uStringLength;
+            Argument arguments[s_uMaxArguments];
+            wchar_t strings[s_uStringCapacity];
+        };
+
+        struct Ring
+        {
+            DWORD dwThreadId = 0;
+            UINT64 ulLoggerId = 0;
+            BOOL bFree = FALSE;                     // Drained after its thread exited, guarded by m_mutex
+            std::atomic<BOOL> bReleased{ FALSE };   // Set when the owning thread exits
+            alignas(64) std::atomic<UINT64> ulHead{ 0 };
+            alignas(64) std::atomic<UINT64> ulTail{ 0 };
+            Record records[s_uRecordCount];
+        };
+
+        // Rings of a thread, released when the thread exits. Shared so that a ring outliving its logger stays valid
+        struct RingOwner
+        {
+            std::vector<std::shared_ptr<Ring>> rings{};
+
+            ~RingOwner();
+        };
+
+        static std::atomic<UINT64> s_ulNextId;
+
+        UINT64 m_ulId;
+        HANDLE m_hFile = INVALID_HANDLE_VALUE;
+        HANDLE m_hWakeEvent = NULL;
+        DWORD m_dwInterval;
+        LONGLONG m_llStart = 0;
+        double m_dTickPeriod = 0;
+
+        std::mutex m_mutex{};
+        std::condition_variable m_flushed{};
+        std::vector<std::shared_ptr<Ring>> m_rings{};
+        UINT64 m_ulFlushRequested = 0;
+        UINT64 m_ulFlushCompleted = 0;
+        std::atomic<UINT64> m_ulDropped{ 0 };
+        std::atomic<BOOL> m_bStop{ FALSE };
+        std::thread m_thread{};
+
+        // Drain thread state
+        std::vector<Ring*> m_snapshot{};
+        std::string m_output{};
+        UINT64 m_ulDroppedReported = 0;
+
+        template<class T>
+        static void AddArgument(Record& record, const T& value);
+
+        Ring& GetRing();
+        void Format(FormatBuffer<1024>& line, const Record& record, DWORD dwThreadId) const;
+        void Write(const FormatBuffer<1024>& line);
+        void Drain();
+        void Run();
+
+    public:
+        // Writes to lpFileName (appending), or to the debugger when it is NULL, every dwInterval milliseconds
+        Logger(LPCWSTR lpFileName = NULL, DWORD dwInterval = 10);
+        ~Logger();
+
+        Logger(const Logger&) = delete;
+        Logger& operator=(const Logger&) = delete;
+
+        template<class... Args>
+        void Log(const wchar_t* pFormat, const Args&... args);
+
+        // Blocks until every record logged before the call has been written
+        void Flush();
+        UINT64 GetDroppedCount() const { return m_ulDropped.load(std::memory_order_relaxed); }
+    };
+
+    /*=========================================================================
+     * Pool definition
+     *
+     * Objects stored contiguously and referenced through 32-bit handles made
+     * of a 20-bit slot index and a 12-bit generation, bumped whenever the slot
+     * is freed so that stale handles are detected instead of reaching another
+     * object. Creation and destruction are O(1), the last object being moved
+     * into the hole left by a destroyed one. A slot whose generation runs out
+     * is retired rather than reused. Pointers returned by Get are invalidated
+     * by Create and Destroy, handles are the references to keep.
+     *=========================================================================*/
+    template<class T>
+    struct Handle
+    {
+        UINT32 uValue = 0;          // 0 is the null handle
+
+        UINT32 GetIndex() const { return uValue & 0xFFFFF; }
+        UINT32 GetGeneration() const { return uValue >> 20; }
+
+        explicit operator bool() const { return uValue != 0; }
+        bool operator==(const Handle& other) const { return uValue == other.uValue; }
+        bool operator!=(const Handle& other) const { return uValue != other.uValue; }
+    };
+
+    template<class T>
+    class Pool
+    {
+    private:
+        static constexpr UINT32 s_uMaxSlots = 1u << 20;
+        static constexpr UINT32 s_uMaxGeneration = 0xFFF;
+        static constexpr UINT32 s_uNone = 0x7FFFFFFF;
+        static constexpr UINT32 s_uFree = 0x80000000;
+
+        struct Slot
+        {
+            UINT32 uDense;          // Index in m_objects, or s_uFree and the next free slot
+            UINT32 uGeneration;
+        };
+
+        std::vector<T> m_objects{};
+        std::vector<UINT32> m_owners{};     // Slot of each object
+        std::vector<Slot> m_slots{};
+        UINT32 m_uFreeHead = s_uNone;
+
+    public:
+        Pool() = default;
+
+        Pool(const Pool&) = delete;
+        Pool& operator=(const Pool&) = delete;
+
+        // Throws once the 2^20 slots are in use
+        template<class... ArgTypes>
+        Handle<T> Create(ArgTypes&&... args);
+        // FALSE for stale and null handles
+        BOOL Destroy(Handle<T> handle);
+        void Clear();
+
+        BOOL IsValid(Handle<T> handle) const;
+        // nullptr for stale and null handles
+        T* Get(Handle<T> handle) { return IsValid(handle) ? &m_objects[m_slots[handle.GetIndex()].uDense] : nullptr; }
+        const T* Get(Handle<T> handle) const { return IsValid(handle) ? &m_objects[m_slots[handle.GetIndex()].uDense] : nullptr; }
+
+        // Dense iteration, in no particular order
+        SIZE_T GetCount() const { return m_objects.size(); }
+        Handle<T> GetHandle(SIZE_T index) const;
+        T* begin() { return m_objects.data(); }
+        T* end() { return m_objects.data() + m_objects.size(); }
+        const T* begin() const { return m_objects.data(); }
+        const T* end() const { return m_objects.data() + m_objects.size(); }
+    };
+
+    /*=========================================================================
+     * AssetLoader definition
+     *
+     * Reads and decodes assets on worker threads, the ones needed for the
+     * first frame ahead of the background ones. Decoded assets are handed to
+     * their callback on the UI thread by Deliver, typically called from
+     * OnPump, the window being woken with WM_NULL when results are waiting.
+     * Loads can be cancelled or reprioritized until they are delivered, a
+     * cancelled load already being decoded is discarded once it completes.
+     *=========================================================================*/
+    enum class AssetPriority
+    {
+        FirstFrame,
+        Background
+    };
+
+    struct AssetProgress
+    {
+        UINT uRequested;            // Loads not cancelled
+        UINT uDelivered;
+        UINT uFailed;               // Delivered without an asset
+        UINT uFirstFrameRequested;
+        UINT uFirstFrameDelivered;
+    };
+
+    class AssetLoader
+    {
+    private:
+        using Delivery = std::function<void()>;
+
+        struct Job
+        {
+            std::wstring path;
+            AssetPriority priority;
+            BOOL bStarted;
+            BOOL bCancelled;
+            // Decodes the file content, nullptr when it could not be read, and returns the delivery
+            std::function<Delivery(std::vector<BYTE>*, BOOL*)> decode;
+        };
+
+        struct Result
+        {
+            Handle<Job> job;
+            BOOL bLoaded;
+            Delivery deliver;
+        };
+
+        static constexpr UINT s_uPriorityCount = 2;
+
+        HWND m_hWnd;
+        std::vector<std::thread> m_threads{};
+        mutable std::mutex m_mutex{};
+        std::condition_variable m_condition{};
+        BOOL m_bStop = FALSE;
+        Pool<Job> m_jobs{};
+        std::deque<Handle<Job>> m_queues[s_uPriorityCount]{};
+        std::vector<Result> m_results{};
+        std::vector<Result> m_delivering{};
+        AssetProgress m_progress{};
+        std::function<void(const AssetProgress&)> m_progressCallback{};
+
+        static BOOL ReadAsset(LPCWSTR lpPath, std::vector<BYTE>& bytes);
+        void Enqueue(Handle<Job> job, AssetPriority priority);
+        void Run();
+
+    public:
+        using AssetHandle = Handle<Job>;
+
+        // hWnd is woken when results are waiting, 0 threads uses one per hardware thread
+        AssetLoader(HWND hWnd, UINT uThreadCount = 0);
+        // Pending loads are dropped, the ones being decoded are waited for
+        ~AssetLoader();
+
+        AssetLoader(const AssetLoader&) = delete;
+        AssetLoader& operator=(const AssetLoader&) = delete;
+
+        // Reads lpPath on a worker and decodes it there with decode(std::vector<BYTE>&), returning the asset.
+        // deliver(AssetType*) then receives the asset on the UI thread, or nullptr if the file could not be
+        // read or decode threw
+        template<class DecodeType, class DeliverType>
+        AssetHandle Load(LPCWSTR lpPath, AssetPriority priority, DecodeType decode, DeliverType deliver);
+        // FALSE when the load was already delivered or cancelled
+        BOOL Cancel(AssetHandle asset);
+        BOOL Reprioritize(AssetHandle asset, AssetPriority priority);
+
+        // Runs the callbacks of the completed loads then the progress callback, on the calling thread
+        void Deliver();
+        // Called by Deliver whenever loads were delivered, to drive a splash screen for example
+        void SetProgressCallback(std::function<void(const AssetProgress&)> callback) { m_progressCallback = std::move(callback); }
+        AssetProgress GetProgress() const;
+        BOOL IsFirstFrameReady() const;
+    };
+}
+
+#ifdef SWL_IMPLEMENTATION
+namespace SWL
+{
+    /*=========================================================================
+     * ApplicationException implementation
+     *=========================================================================*/
+    ApplicationException::ApplicationException(LPCWSTR lpInfo)
+    {
+        m_info = {};
+        m_info += lpInfo;
+        m_info += L" | Error code : ";
+        m_info += std::to_wstring(GetLastError());
+    }
+
+    void ApplicationException::ShowMessageBox() { MessageBoxW(NULL, m_info.c_str(), NULL, MB_ICONERROR); }
+
+    void ApplicationException::ShowDebugOutput() { OutputDebugStringW(m_info.c_str()); }
+
+    /*=========================================================================
+     * Pixel memory implementation
+     *=========================================================================*/
+    std::atomic<BOOL> PixelBuffer::s_bLargePages{ FALSE };
+
+    PixelBuffer::PixelBuffer(SIZE_T nCount) : m_nCount(nCount), m_nCapacity(nCount)
+    {
+        SIZE_T nBytes = nCount * sizeof(UINT32);
+        if (nBytes < s_nPageThreshold)
+        {
+            m_pPixels = new UINT32[nCount]();
+            return;
+        }
+
+        // Large pages are locked in memory and must be allocated in multiples of their size
+        SIZE_T nLargePage = GetLargePageMinimum();
+        if (s_bLargePages.load(std::memory_order_relaxed) && nLargePage != 0 && nBytes >= nLargePage)
+        {
+            SIZE_T nLargeBytes = (nBytes + nLargePage - 1) / nLargePage * nLargePage;
+            m_pPixels = (UINT32*)VirtualAlloc(NULL, nLargeBytes, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE);
+            m_bLargePages = m_pPixels != nullptr;
+            if (m_bLargePages)
+                m_nCapacity = nLargeBytes / sizeof(UINT32);
+        }
+        if (m_pPixels == nullptr)
+            m_pPixels = (UINT32*)VirtualAlloc(NULL, nBytes, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+        if (m_pPixels == nullptr)
+            throw ApplicationException(L"Failed to allocate the pixels (VirtualAlloc)");
+        m_bPages = TRUE;
+    }
+
+    PixelBuffer::PixelBuffer(PixelBuffer&& other) noexcept
+        : m_pPixels(other.m_pPixels), m_nCount(other.m_nCount), m_nCapacity(other.m_nCapacity), m_bPages(other.m_bPages), m_bLargePages(other.m_bLargePages)
+    {
+        other.m_pPixels = nullptr;
+        other.m_nCount = 0;
+        other.m_nCapacity = 0;
+        other.m_bPages = FALSE;
+        other.m_bLargePages = FALSE;
+    }
+
+    PixelBuffer& PixelBuffer::operator=(PixelBuffer&& other) noexcept
+    {
+        if (this != &other)
+        {
+            Release();
+            m_pPixels = other.m_pPixels;
+            m_nCount = other.m_nCount;
+            m_nCapacity = other.m_nCapacity;
+            m_bPages = other.m_bPages;
+            m_bLargePages = other.m_bLargePages;
+            other.m_pPixels = nullptr;
+            other.m_nCount = 0;
+            other.m_nCapacity = 0;
+            other.m_bPages = FALSE;
+            other.m_bLargePages = FALSE;
+        }
+        return *this;
+    }
+
+    void PixelBuffer::Resize(SIZE_T nCount)
+    {
+        BOOL bPages = nCount * sizeof(UINT32) >= s_nPageThreshold;
+        if (m_pPixels == nullptr || nCount > m_nCapacity || bPages != m_bPages)
+        {
+            *this = PixelBuffer(nCount);
+            return;
+        }
+
+        m_nCount = nCount;
+        std::fill_n(m_pPixels, nCount, 0u);
+    }
+
+    void PixelBuffer::Release()
+    {
+        if (m_bPages)
+            VirtualFree(m_pPixels, 0, MEM_RELEASE);
+        else
+            delete[] m_pPixels;
+        m_pPixels = nullptr;
+        m_nCount = 0;
+        m_nCapacity = 0;
+        m_bPages = FALSE;
+        m_bLargePages = FALSE;
+    }
+
+    BOOL PixelBuffer::EnableLargePages()
+    {
+        HANDLE hToken = NULL;
+        if (!OpenProcessToken(GetCurrentProcess(), TOKEN_ADJUST_PRIVILEGES | TOKEN_QUERY, &hToken))
+            return FALSE;
+
+        TOKEN_PRIVILEGES privileges = {};
+        privileges.PrivilegeCount = 1;
+        privileges.Privileges[0].Attributes = SE_PRIVILEGE_ENABLED;
+        BOOL bEnabled = LookupPrivilegeValueW(NULL, SE_LOCK_MEMORY_NAME, &privileges.Privileges[0].Luid)
+            && AdjustTokenPrivileges(hToken, FALSE, &privileges, 0, NULL, NULL)
+            && GetLastError() == ERROR_SUCCESS;     // ERROR_NOT_ALL_ASSIGNED when the right is missing
+        CloseHandle(hToken);
+
+        s_bLargePages.store(bEnabled && GetLargePageMinimum() != 0, std::memory_order_relaxed);
+        return s_bLargePages.load(std::memory_order_relaxed);
+    }
+
+    // Smallest size timed by MeasureStreamingThreshold
+    static constexpr SIZE_T g_nMinStreamingBytes = 1 << 20;
+    static std::atomic<SIZE_T> g_nStreamingThreshold{ 0 };
+    static std::once_flag g_streamingTuned;
+
+    // Non-temporal kernels, the caller issuing the _mm_sfence once all the rows were written
+    static void FillPixelsStreaming(UINT32* pDst, SIZE_T nCount, UINT32 uColor)
+    {
+        for (; nCount > 0 && ((UINT_PTR)pDst & 15) != 0; nCount--)
+            *pDst++ = uColor;
+
+        __m128i color = _mm_set1_epi32((int)uColor);
+        for (; nCount >= 16; nCount -= 16, pDst += 16)
+        {
+            _mm_stream_si128((__m128i*)pDst, color);
+            _mm_stream_si128((__m128i*)(pDst + 4), color);
+            _mm_stream_si128((__m128i*)(pDst + 8), color);
+            _mm_stream_si128((__m128i*)(pDst + 12), color);
+        }
+        for (; nCount >= 4; nCount -= 4, pDst += 4)
+            _mm_stream_si128((__m128i*)pDst, color);
+
+        for (; nCount > 0; nCount--)
+            *pDst++ = uColor;
+    }
+
+    static void CopyPixelsStreaming(UINT32* pDst, const UINT32* pSrc, SIZE_T nCount)
+    {
+        for (; nCount > 0 && ((UINT_PTR)pDst & 15) != 0; nCount--)
+            *pDst++ = *pSrc++;
+
+        for (; nCount >= 16; nCount -= 16, pDst += 16, pSrc += 16)
+        {
+            __m128i a = _mm_loadu_si128((const __m128i*)pSrc);
+            __m128i b = _mm_loadu_si128((const __m128i*)(pSrc + 4));
+            __m128i c = _mm_loadu_si128((const __m128i*)(pSrc + 8));
+            __m128i d = _mm_loadu_si128((const __m128i*)(pSrc + 12));
+            _mm_stream_si128((__m128i*)pDst, a);
+            _mm_stream_si128((__m128i*)(pDst + 4), b);
+            _mm_stream_si128((__m128i*)(pDst + 8), c);
+            _mm_stream_si128((__m128i*)(pDst + 12), d);
+        }
+        for (; nCount >= 4; nCount -= 4, pDst += 4, pSrc += 4)
+            _mm_stream_si128((__m128i*)pDst, _mm_loadu_si128((const __m128i*)pSrc));
+
+        for (; nCount > 0; nCount--)
+            *pDst++ = *pSrc++;
+    }
+
+    static SIZE_T MeasureStreamingThreshold()
+    {
+        // Streaming stores win once the buffer no longer stays in the caches between two fills. Sizes are
+        // timed from 16 MiB down, the threshold being the smallest from which streaming keeps winning
+        constexpr SIZE_T nMaxBytes = 16 << 20;
+        PixelBuffer buffer(nMaxBytes / sizeof(UINT32));
+        SIZE_T nThreshold = MAXSIZE_T;
+        for (SIZE_T nBytes = nMaxBytes; nBytes >= g_nMinStreamingBytes; nBytes /= 2)
+        {
+            SIZE_T nCount = nBytes / sizeof(UINT32);
+            LONGLONG llTemporal = MAXLONGLONG, llStreaming = MAXLONGLONG;
+            for (int nTrial = 0; nTrial < 3; nTrial++)
+            {
+                LONGLONG llStart = QpcClock::Now();
+                std::fill_n(buffer.GetData(), nCount, (UINT32)nTrial);
+                llTemporal = (std::min)(llTemporal, QpcClock::Now() - llStart);
+            }
+            for (int nTrial = 0; nTrial < 3; nTrial++)
+            {
+                LONGLONG llStart = QpcClock::Now();
+                FillPixelsStreaming(buffer.GetData(), nCount, (UINT32)nTrial);
+                _mm_sfence();
+                llStreaming = (std::min)(llStreaming, QpcClock::Now() - llStart);
+            }
+            if (llStreaming > llTemporal)
+                break;
+            nThreshold = nBytes;
+        }
+        return nThreshold;
+    }
+
+    void TuneStreamingThreshold()
+    {
+        std::call_once(g_streamingTuned, []()
+        {
+            if (g_nStreamingThreshold.load(std::memory_order_relaxed) != 0)
+                return;
+
+            // A SetStreamingThreshold made during the measurement wins
+            SIZE_T nUnset = 0;
+            g_nStreamingThreshold.compare_exchange_strong(nUnset, MeasureStreamingThreshold(), std::memory_order_relaxed);
+        });
+    }
+
+    SIZE_T GetStreamingThreshold()
+    {
+        if (g_nStreamingThreshold.load(std::memory_order_relaxed) == 0)
+            TuneStreamingThreshold();
+        return g_nStreamingThreshold.load(std::memory_order_relaxed);
+    }
+
+    void SetStreamingThreshold(SIZE_T nBytes) { g_nStreamingThreshold.store((std::max)(nBytes, (SIZE_T)1), std::memory_order_relaxed); }
+
+    static BOOL IsStreamingSize(SIZE_T nBytes)
+    {
+        // Measured thresholds are never below the smallest measured size, smaller surfaces need no measurement
+        SIZE_T nThreshold = g_nStreamingThreshold.load(std::memory_order_relaxed);
+        if (nThreshold == 0)
+        {
+            if (nBytes < g_nMinStreamingBytes)
+                return FALSE;
+            nThreshold = GetStreamingThreshold();
+        }
+        return nBytes >= nThreshold;
+    }
+
+    void FillSurface(const Surface& dst, UINT32 uColor)
+    {
+        if (dst.nWidth <= 0 || dst.nHeight <= 0)
+            return;
+
+        // Contiguous rows are filled as a single run
+        BOOL bContiguous = dst.nStride == dst.nWidth;
+        int nRuns = bContiguous ? 1 : dst.nHeight;
+        SIZE_T nRun = bContiguous ? (SIZE_T)dst.nWidth * dst.nHeight : (SIZE_T)dst.nWidth;
+        if (!IsStreamingSize((SIZE_T)dst.nWidth * dst.nHeight * sizeof(UINT32)))
+        {
+            for (int y = 0; y < nRuns; y++)
+                std::fill_n(dst.GetRow(y), nRun, uColor);
+            return;
+        }
+
+        for (int y = 0; y < nRuns; y++)
+            FillPixelsStreaming(dst.GetRow(y), nRun, uColor);
+        _mm_sfence();
+    }
+
+    void CopySurface(const Surface& dst, const Surface& src)
+    {
+        int nWidth = (std::min)(dst.nWidth, src.nWidth);
+        int nHeight = (std::min)(dst.nHeight, src.nHeight);
+        if (nWidth <= 0 || nHeight <= 0)
+            return;
+
+        BOOL bContiguous = dst.nStride == nWidth && src.nStride == nWidth;
+        int nRuns = bContiguous ? 1 : nHeight;
+        SIZE_T nRun = bContiguous ? (SIZE_T)nWidth * nHeight : (SIZE_T)nWidth;
+        if (!IsStreamingSize((SIZE_T)nWidth * nHeight * sizeof(UINT32)))
+        {
+            for (int y = 0; y < nRuns; y++)
+                memcpy(dst.GetRow(y), src.GetRow(y), nRun * sizeof(UINT32));
+            return;
+        }
+
+        for (int y = 0; y < nRuns; y++)
+            CopyPixelsStreaming(dst.GetRow(y), src.GetRow(y), nRun);
+        _mm_sfence();
+    }
+
+    /*=========================================================================
+     * Image implementation
+     *=========================================================================*/
+    Image::Image(int nWidth, int nHeight) { Resize(nWidth, nHeight); }
+
+    Image::Image(const Image& other) : Image(other.GetWidth(), other.GetHeight()) { CopySurface(m_surface, other.m_surface); }
+
+    Image::Image(Image&& other) noexcept : m_pixels(std::move(other.m_pixels)), m_surface(other.m_surface) { other.m_surface = {}; }
+
+    Image& Image::operator=(const Image& other)
+    {
+        if (this != &other)
+        {
+            Resize(other.GetWidth(), other.GetHeight());
+            CopySurface(m_surface, other.m_surface);
+        }
+        return *this;
+    }
+
+    Image& Image::operator=(Image&& other) noexcept
+    {
+        if (this != &other)
+        {
+            m_pixels = std::move(other.m_pixels);
+            m_surface = other.m_surface;
+            other.m_surface = {};
+        }
+        return *this;
+    }
+
+    void Image::Resize(int nWidth, int nHeight)
+    {
+        m_pixels.Resize((SIZE_T)(std::max)(nWidth, 0) * (std::max)(nHeight, 0));
+        m_surface.pPixels = m_pixels.GetData();
+        m_surface.nWidth = nWidth;
+        m_surface.nHeight = nHeight;
+        m_surface.nStride = nWidth;
+    }
+
+    void Image::Clear(UINT32 uColor) { FillSurface(m_surface, uColor); }
+
+    /*=========================================================================
+     * Metrics implementation
+     *=========================================================================*/
+    MetricsPublisher::~MetricsPublisher()
+    {
+        if (m_pSegment)
+        {
+            UnmapViewOfFile(m_pSegment);
+            CloseHandle(m_hMapping);
+        }
+    }
+
+    void MetricsPublisher::Create(LPCWSTR lpName)
+    {
+        if (m_pSegment)
+            return;
+
+        m_hMapping = CreateFileMappingW(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, 0, sizeof(MetricsSegment), lpName);
+        if (m_hMapping == NULL)
+            throw ApplicationException(L"Failed to create the metrics mapping (CreateFileMappingW)");
+
+        // Another instance publishing under the same name would have its sequence reset under its readers
+        if (GetLastError() == ERROR_ALREADY_EXISTS)
+        {
+            CloseHandle(m_hMapping);
+            m_hMapping = NULL;
+            throw ApplicationException(L"Failed to create the metrics mapping, the name is already in use (CreateFileMappingW)");
+        }
+
+        MetricsSegment* pSegment = (MetricsSegment*)MapViewOfFile(m_hMapping, FILE_MAP_ALL_ACCESS, 0, 0, sizeof(MetricsSegment));
+        if (pSegment == nullptr)
+        {
+            CloseHandle(m_hMapping);
+            throw ApplicationException(L"Failed to map the metrics (MapViewOfFile)");
+        }
+
+        LARGE_INTEGER liFrequency = {};
+        QueryPerformanceFrequency(&liFrequency);
+        m_dMicrosecondsPerTick = 1e6 / liFrequency.QuadPart;
+
+        // The magic is written last, readers opening the segment earlier reject it
+        pSegment->uVersion = MetricsSegment::s_uVersion;
+        pSegment->uSize = sizeof(MetricsSegment);
+        pSegment->dwProcessId = GetCurrentProcessId();
+        pSegment->llFrequency = liFrequency.QuadPart;
+        std::atomic_thread_fence(std::memory_order_release);
+        pSegment->uMagic = MetricsSegment::s_uMagic;
+        m_pSegment = pSegment;
+    }
+
+    UINT MetricsPublisher::GetBucket(LONGLONG llTicks) const
+    {
+        UINT64 ullMicroseconds = (UINT64)(std::max)(llTicks * m_dMicrosecondsPerTick, 0.0);
+        UINT uBucket = 0;
+        while (ullMicroseconds >>= 1)
+            uBucket++;
+        return (std::min)(uBucket, Metrics::s_uBucketCount - 1);
+    }
+
+    void MetricsPublisher::RecordDispatch(LONGLONG llTicks)
+    {
+        m_metrics.ullMessages++;
+        m_metrics.llLastDispatchTicks = llTicks;
+        m_metrics.ullDispatchHistogram[GetBucket(llTicks)]++;
+    }
+
+    void MetricsPublisher::RecordPump(UINT32 uMessages)
+    {
+        m_metrics.ullPumps++;
+        m_metrics.uLastPumpMessages = uMessages;
+        m_metrics.uMaxPumpMessages = (std::max)(m_metrics.uMaxPumpMessages, uMessages);
+    }
+
+    void MetricsPublisher::RecordFrame(LONGLONG llRenderTicks, LONGLONG llPresented)
+    {
+        m_metrics.ullFrames++;
+        m_metrics.llLastRenderTicks = llRenderTicks;
+        if (m_llLastFrame)
+        {
+            m_metrics.llLastFrameTicks = llPresented - m_llLastFrame;
+            m_metrics.ullFrameHistogram[GetBucket(m_metrics.llLastFrameTicks)]++;
+        }
+        m_llLastFrame = llPresented;
+    }
+
+    void MetricsPublisher::SetCounter(UINT uIndex, LONGLONG llValue)
+    {
+        if (uIndex < Metrics::s_uCounterCount)
+            m_metrics.llCounters[uIndex] = llValue;
+    }
+
+    void MetricsPublisher::Publish()
+    {
+        if (m_pSegment == nullptr)
+            return;
+
+        // Odd while the copy is in progress
+        UINT32 uSequence = m_pSegment->uSequence.load(std::memory_order_relaxed);
+        m_pSegment->uSequence.store(uSequence + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        memcpy(&m_pSegment->metrics, &m_metrics, sizeof(Metrics));
+        m_pSegment->uSequence.store(uSequence + 2, std::memory_order_release);
+    }
+
+    MetricsReader::MetricsReader(LPCWSTR lpName)
+    {
+        m_hMapping = OpenFileMappingW(FILE_MAP_READ, FALSE, lpName);
+        if (m_hMapping == NULL)
+            throw ApplicationException(L"Failed to open the metrics mapping (OpenFileMappingW)");
+
+        m_pSegment = (const MetricsSegment*)MapViewOfFile(m_hMapping, FILE_MAP_READ, 0, 0, sizeof(MetricsSegment));
+        if (m_pSegment == nullptr || m_pSegment->uMagic != MetricsSegment::s_uMagic
+            || m_pSegment->uVersion != MetricsSegment::s_uVersion || m_pSegment->uSize != sizeof(MetricsSegment))
+        {
+            if (m_pSegment)
+                UnmapViewOfFile(m_pSegment);
+            CloseHandle(m_hMapping);
+            throw ApplicationException(L"Failed to map the metrics, missing or incompatible version (MapViewOfFile)");
+        }
+    }
+
+    MetricsReader::~MetricsReader()
+    {
+        UnmapViewOfFile(m_pSegment);
+        CloseHandle(m_hMapping);
+    }
+
+    BOOL MetricsReader::Read(Metrics& metrics) const
+    {
+        for (int nAttempt = 0; nAttempt < 64; nAttempt++)
+        {
+            UINT32 uSequence = m_pSegment->uSequence.load(std::memory_order_acquire);
+            if (uSequence & 1)
+            {
+                YieldProcessor();
+                continue;
+            }
+
+            memcpy(&metrics, (const void*)&m_pSegment->metrics, sizeof(Metrics));
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (m_pSegment->uSequence.load(std::memory_order_relaxed) == uSequence)
+                return TRUE;
+        }
+        return FALSE;
+    }
+
+    /*=========================================================================
+     * Clock implementation
+     *=========================================================================*/
+    LONGLONG QpcClock::Now()
+    {
+        LARGE_INTEGER liNow;
+        QueryPerformanceCounter(&liNow);
+        return liNow.QuadPart;
+    }
+
+    LONGLONG QpcClock::GetFrequency()
+    {
+        static const LONGLONG llFrequency = []
+        {
+            LARGE_INTEGER liFrequency;
+            QueryPerformanceFrequency(&liFrequency);
+            return liFrequency.QuadPart;
+        }();
+        return llFrequency;
+    }
+
+    /*=========================================================================
+     * PointerPredictor implementation
+     *=========================================================================*/
+    PointerPredictor::PointerPredictor(LONGLONG llFrequency) : m_dTickPeriod(1.0 / llFrequency) {}
+
+    PointerPredictor::PointerPredictor(LONGLONG llFrequency, const Settings& settings)
+        : m_settings(settings), m_dTickPeriod(1.0 / llFrequency) {}
+
+    void PointerPredictor::AddSample(float x, float y, LONGLONG llTimestamp)
+    {
+        m_raw = { llTimestamp, x, y };
+        if (m_uCount == 0)
+        {
+            m_samples[0] = { llTimestamp, x, y };
+            m_uCount = 1;
+            m_uNext = 1;
+            m_fSpeed = 0;
+            return;
+        }
+
+        const Sample& previous = m_samples[(m_uNext + s_uMaxSamples - 1) % s_uMaxSamples];
+        float dt = (float)((llTimestamp - previous.llTimestamp) * m_dTickPeriod);
+        if (dt <= 0)
+            return;
+
+        // A pause breaks the trajectory, the old samples would only drag the fit
+        if (dt > m_settings.fStopTimeout)
+        {
+            Reset();
+            AddSample(x, y, llTimestamp);
+            return;
+        }
+
+        // One-Euro filter: the cutoff rises with the smoothed speed
+        auto Alpha = [dt](float fCutoff) { return 1.0f / (1.0f + 1.0f / (6.2831853f * fCutoff * dt)); };
+        float fSpeed = sqrtf((x - previous.x) * (x - previous.x) + (y - previous.y) * (y - previous.y)) / dt;
+        m_fSpeed += (fSpeed - m_fSpeed) * Alpha(m_settings.fDerivativeCutoff);
+        float fAlpha = Alpha(m_settings.fMinCutoff + m_settings.fBeta * m_fSpeed);
+
+        m_samples[m_uNext] = { llTimestamp, previous.x + (x - previous.x) * fAlpha, previous.y + (y - previous.y) * fAlpha };
+        m_uNext = (m_uNext + 1) % s_uMaxSamples;
+        m_uCount = (std::min)(m_uCount + 1, s_uMaxSamples);
+    }
+
+    BOOL PointerPredictor::Predict(LONGLONG llNow, LONGLONG llTarget, float* px, float* py) const
+    {
+        if (m_uCount == 0)
+            return FALSE;
+
+        // Once the pointer stopped the filter has nothing left to smooth, the raw position is exact
+        const Sample& last = m_samples[(m_uNext + s_uMaxSamples - 1) % s_uMaxSamples];
+        if ((llNow - last.llTimestamp) * m_dTickPeriod > m_settings.fStopTimeout)
+        {
+            *px = m_raw.x;
+            *py = m_raw.y;
+            return TRUE;
+        }
+
+        *px = last.x;
+        *py = last.y;
+        double dHorizon = (std::min)((llTarget - last.llTimestamp) * m_dTickPeriod, (double)m_settings.fMaxHorizon);
+        if (dHorizon <= 0)
+            return TRUE;
+
+        // Normal equations of the fit, times relative to the last sample
+        UINT uDegree = (std::min)((std::max)(m_settings.uDegree, 1u), 2u);
+        double dMoments[5] = {}, dX[3] = {}, dY[3] = {};
+        UINT uUsed = 0;
+        for (UINT i = 1; i <= m_uCount; i++)
+        {
+            const Sample& sample = m_samples[(m_uNext + s_uMaxSamples - i) % s_uMaxSamples];
+            double t = (sample.llTimestamp - last.llTimestamp) * m_dTickPeriod;
+            if (-t > m_settings.fWindow)
+                break;
+
+            double dPower = 1;
+            for (UINT k = 0; k <= 2 * uDegree; k++, dPower *= t)
+            {
+                dMoments[k] += dPower;
+                if (k <= uDegree)
+                {
+                    dX[k] += sample.x * dPower;
+                    dY[k] += sample.y * dPower;
+                }
+            }
+            uUsed++;
+        }
+        if (uUsed <= uDegree)
+            return TRUE;
+
+        // Gaussian elimination on the (uDegree + 1)² system, both axes at once
+        UINT n = uDegree + 1;
+        double dMatrix[3][5] = {};
+        for (UINT r = 0; r < n; r++)
+        {
+            for (UINT c = 0; c < n; c++)
+                dMatrix[r][c] = dMoments[r + c];
+            dMatrix[r][n] = dX[r];
+            dMatrix[r][n + 1] = dY[r];
+        }
+        for (UINT c = 0; c < n; c++)
+        {
+            if (fabs(dMatrix[c][c]) < 1e-18)
+                return TRUE;
+            for (UINT r = 0; r < n; r++)
+            {
+                if (r == c)
+                    continue;
+                double dFactor = dMatrix[r][c] / dMatrix[c][c];
+                for (UINT k = c; k < n + 2; k++)
+                    dMatrix[r][k] -= dFactor * dMatrix[c][k];
+            }
+        }
+
+        // The fitted curve is evaluated from the last sample, so the prediction moves it but never jumps
+        double h = dHorizon * (std::min)((std::max)(m_settings.fAggressiveness, 0.0f), 1.0f);
+        double dPower = 1, dOffsetX = 0, dOffsetY = 0;
+        for (UINT k = 1; k < n; k++)
+        {
+            dPower *= h;
+            dOffsetX += dMatrix[k][n] / dMatrix[k][k] * dPower;
+            dOffsetY += dMatrix[k][n + 1] / dMatrix[k][k] * dPower;
+        }
+        *px = (float)(last.x + dOffsetX);
+        *py = (float)(last.y + dOffsetY);
+        return TRUE;
+    }
+
+    /*=========================================================================
+     * Pointer input implementation
+     *=========================================================================*/
+    void PointerContacts::Update(const PointerSample* pSamples, UINT uCount)
+    {
+        for (UINT i = 0; i < uCount; i++)
+        {
+            const PointerSample& sample = pSamples[i];
+            auto it = std::find_if(m_contacts.begin(), m_contacts.end(),
+                [&](const Contact& contact) { return contact.first.uPointerId == sample.uPointerId; });
+
+            BOOL bDown = (sample.dwFlags & POINTER_FLAG_INCONTACT) && !(sample.dwFlags & (POINTER_FLAG_UP | POINTER_FLAG_CANCELED));
+            if (!bDown)
+            {
+                if (it != m_contacts.end())
+                    m_contacts.erase(it);
+                continue;
+            }
+
+            // Contacts already down when tracking started begin at their first sample
+            if (it == m_contacts.end())
+                m_contacts.push_back({ sample, sample });
+            else
+                it->last = sample;
+        }
+    }
+
+    void PointerContacts::Remove(UINT32 uPointerId)
+    {
+        m_contacts.erase(std::remove_if(m_contacts.begin(), m_contacts.end(),
+            [&](const Contact& contact) { return contact.first.uPointerId == uPointerId; }), m_contacts.end());
+    }
+
+    const PointerContacts::Contact* PointerContacts::Find(UINT32 uPointerId) const
+    {
+        for (const Contact& contact : m_contacts)
+        {
+            if (contact.first.uPointerId == uPointerId)
+                return &contact;
+        }
+        return nullptr;
+    }
+
+    /*=========================================================================
+     * Gamepad implementation
+     *=========================================================================*/
+    static std::atomic<UINT> s_uGamepadMessage{ 0 };
+
+    UINT GetGamepadMessage()
+    {
+        UINT uMessage = s_uGamepadMessage.load(std::memory_order_acquire);
+        if (uMessage == 0)
+        {
+            uMessage = RegisterWindowMessageW(L"SWL_Gamepad");
+            s_uGamepadMessage.store(uMessage, std::memory_order_release);
+        }
+        return uMessage;
+    }
+
+    UINT PeekGamepadMessage()
+    {
+        return s_uGamepadMessage.load(std::memory_order_acquire);
+    }
+
+    DWORD XInputSource::GetState(DWORD dwUserIndex, XINPUT_STATE* pState)
+    {
+        // Resolved at run time so that applications without gamepads do not link against XInput
+        using GetStateFunction = DWORD (WINAPI*)(DWORD, XINPUT_STATE*);
+        static const GetStateFunction pfnGetState = []() -> GetStateFunction
+        {
+            HMODULE hModule = LoadLibraryW(L"xinput1_4.dll");
+            if (hModule == NULL)
+                hModule = LoadLibraryW(L"xinput9_1_0.dll");
+            return hModule ? (GetStateFunction)(void (*)())GetProcAddress(hModule, "XInputGetState") : nullptr;
+        }();
+        return pfnGetState ? pfnGetState(dwUserIndex, pState) : ERROR_DEVICE_NOT_CONNECTED;
+    }
+
+    template<class SourceType>
+    GamepadPoller<SourceType>::GamepadPoller(HWND hWnd, DWORD dwInterval, DWORD dwProbeInterval, SourceType source)
+        : m_source(std::move(source)), m_hWnd(hWnd), m_dwInterval(dwInterval), m_dwProbeInterval(dwProbeInterval)
+    {
+        m_hStopEvent = CreateEventW(NULL, TRUE, FALSE, NULL);
+        if (m_hStopEvent == NULL)
+            throw ApplicationException(L"Failed to create the gamepad event (CreateEventW)");
+
+        GetGamepadMessage();
+        m_thread = std::thread(&GamepadPoller::Run, this);
+    }
+
+    template<class SourceType>
+    GamepadPoller<SourceType>::~GamepadPoller()
+    {
+        SetEvent(m_hStopEvent);
+        m_thread.join();
+        CloseHandle(m_hStopEvent);
+    }
+
+    template<class SourceType>
+    void GamepadPoller<SourceType>::Convert(const XINPUT_GAMEPAD& gamepad, GamepadState& state) const
+    {
+        state.wButtons = gamepad.wButtons;
+
+        // Both sticks at once: each lane is scaled by (|stick| - deadzone) / (1 - deadzone) / |stick|
+        __m128 axes = _mm_mul_ps(_mm_set_ps(gamepad.sThumbRY, gamepad.sThumbRX, gamepad.sThumbLY, gamepad.sThumbLX),
+            _mm_set1_ps(1.0f / 32767.0f));
+        axes = _mm_max_ps(axes, _mm_set1_ps(-1.0f));
+        __m128 squares = _mm_mul_ps(axes, axes);
+        __m128 magnitudes = _mm_sqrt_ps(_mm_add_ps(squares, _mm_shuffle_ps(squares, squares, _MM_SHUFFLE(2, 3, 0, 1))));
+        __m128 deadzones = _mm_set_ps(m_fRightDeadzone, m_fRightDeadzone, m_fLeftDeadzone, m_fLeftDeadzone);
+        __m128 lengths = _mm_div_ps(_mm_max_ps(_mm_sub_ps(magnitudes, deadzones), _mm_setzero_ps()),
+            _mm_sub_ps(_mm_set1_ps(1.0f), deadzones));
+        lengths = _mm_min_ps(lengths, _mm_set1_ps(1.0f));
+        __m128 scales = _mm_div_ps(lengths, _mm_max_ps(magnitudes, _mm_set1_ps(1e-6f)));
+
+        alignas(16) float fAxes[4];
+        _mm_store_ps(fAxes, _mm_mul_ps(axes, scales));
+        state.fLeftX = fAxes[0];
+        state.fLeftY = fAxes[1];
+        state.fRightX = fAxes[2];
+        state.fRightY = fAxes[3];
+
+        float fScale = 1.0f / (1.0f - m_fTriggerDeadzone);
+        state.fLeftTrigger = (std::max)(gamepad.bLeftTrigger / 255.0f - m_fTriggerDeadzone, 0.0f) * fScale;
+        state.fRightTrigger = (std::max)(gamepad.bRightTrigger / 255.0f - m_fTriggerDeadzone, 0.0f) * fScale;
+    }
+
+    template<class SourceType>
+    void GamepadPoller<SourceType>::Publish(UINT uPad, const GamepadState& state)
+    {
+        // Odd while the copy is in progress, readers retry
+        Slot& slot = m_slots[uPad];
+        UINT32 uSequence = slot.uSequence.load(std::memory_order_relaxed);
+        slot.uSequence.store(uSequence + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        memcpy(&slot.state, &state, sizeof(GamepadState));
+        slot.uSequence.store(uSequence + 2, std::memory_order_release);
+    }
+
+    template<class SourceType>
+    GamepadState GamepadPoller<SourceType>::GetState(UINT uPad) const
+    {
+        GamepadState state = {};
+        if (uPad >= s_uMaxPads)
+            return state;
+
+        const Slot& slot = m_slots[uPad];
+        for (;;)
+        {
+            UINT32 uSequence = slot.uSequence.load(std::memory_order_acquire);
+            if (uSequence & 1)
+            {
+                YieldProcessor();
+                continue;
+            }
+
+            memcpy(&state, (const void*)&slot.state, sizeof(GamepadState));
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (slot.uSequence.load(std::memory_order_relaxed) == uSequence)
+                return state;
+        }
+    }
+
+    template<class SourceType>
+    void GamepadPoller<SourceType>::Run()
+    {
+        GamepadState states[s_uMaxPads] = {};
+        ULONGLONG ullNextProbe[s_uMaxPads] = {};
+        UINT uMessage = GetGamepadMessage();
+
+        do
+        {
+            ULONGLONG ullNow = GetTickCount64();
+            for (UINT uPad = 0; uPad < s_uMaxPads; uPad++)
+            {
+                GamepadState& state = states[uPad];
+                if (!state.bConnected && ullNow < ullNextProbe[uPad])
+                    continue;
+
+                XINPUT_STATE xinputState = {};
+                if (m_source.GetState(uPad, &xinputState) != ERROR_SUCCESS)
+                {
+                    ullNextProbe[uPad] = ullNow + m_dwProbeInterval;
+                    if (state.bConnected)
+                    {
+                        state = {};
+                        Publish(uPad, state);
+                        PostMessageW(m_hWnd, uMessage, MAKEWPARAM(uPad, Disconnected), 0);
+                    }
+                    continue;
+                }
+
+                BOOL bConnected = state.bConnected;
+                if (bConnected && xinputState.dwPacketNumber == state.dwPacket)
+                    continue;
+
+                WORD wPrevious = state.wButtons;
+                state.bConnected = TRUE;
+                state.dwPacket = xinputState.dwPacketNumber;
+                Convert(xinputState.Gamepad, state);
+                Publish(uPad, state);
+
+                if (!bConnected)
+                    PostMessageW(m_hWnd, uMessage, MAKEWPARAM(uPad, Connected), 0);
+                WORD wPressed = state.wButtons & ~wPrevious;
+                WORD wReleased = wPrevious & ~state.wButtons;
+                if (wPressed || wReleased)
+                    PostMessageW(m_hWnd, uMessage, MAKEWPARAM(uPad, Buttons), MAKELPARAM(wPressed, wReleased));
+            }
+        } while (WaitForSingleObject(m_hStopEvent, m_dwInterval) == WAIT_TIMEOUT);
+    }
+
+    /*=========================================================================
+     * Thread scheduling implementation
+     *=========================================================================*/
+    // Avrt is loaded on first use so that only applications registering MMCSS tasks depend on it
+    struct AvrtFunctions
+    {
+        decltype(&AvSetMmThreadCharacteristicsW) pfnSetCharacteristics = nullptr;
+        decltype(&AvSetMmThreadPriority) pfnSetPriority = nullptr;
+        decltype(&AvRevertMmThreadCharacteristics) pfnRevert = nullptr;
+    };
+
+    static const AvrtFunctions& GetAvrtFunctions()
+    {
+        static const AvrtFunctions functions = []
+        {
+            AvrtFunctions functions;
+            HMODULE hModule = LoadLibraryW(L"avrt.dll");
+            if (hModule == NULL)
+                return functions;
+
+            functions.pfnSetCharacteristics = (decltype(functions.pfnSetCharacteristics))(void (*)())GetProcAddress(hModule, "AvSetMmThreadCharacteristicsW");
+            functions.pfnSetPriority = (decltype(functions.pfnSetPriority))(void (*)())GetProcAddress(hModule, "AvSetMmThreadPriority");
+            functions.pfnRevert = (decltype(functions.pfnRevert))(void (*)())GetProcAddress(hModule, "AvRevertMmThreadCharacteristics");
+            if (!functions.pfnSetCharacteristics || !functions.pfnSetPriority || !functions.pfnRevert)
+                functions = {};
+            return functions;
+        }();
+        return functions;
+    }
+
+    ThreadPolicy ThreadPolicy::ForRole(ThreadRole role)
+    {
+        ThreadPolicy policy = {};
+        switch (role)
+        {
+        case ThreadRole::Ui:
+            policy.nPriority = THREAD_PRIORITY_ABOVE_NORMAL;
+            break;
+        case ThreadRole::Render:
+            policy.nPriority = THREAD_PRIORITY_HIGHEST;
+            policy.lpMmcssTask = L"Games";
+            policy.mmcssPriority = AVRT_PRIORITY_HIGH;
+            break;
+        case ThreadRole::Worker:
+            policy.nPriority = THREAD_PRIORITY_NORMAL;
+            break;
+        case ThreadRole::Background:
+            policy.nPriority = THREAD_PRIORITY_LOWEST;
+            break;
+        }
+        return policy;
+    }
+
+    ThreadSchedule::ThreadSchedule(const ThreadPolicy& policy)
+    {
+        m_hThread = GetCurrentThread();
+        m_nPreviousPriority = GetThreadPriority(m_hThread);
+
+        if (policy.ullAffinity != 0)
+        {
+            m_ullPreviousAffinity = SetThreadAffinityMask(m_hThread, policy.ullAffinity);
+            if (m_ullPreviousAffinity == 0)
+                throw ApplicationException(L"Failed to set the thread affinity (SetThreadAffinityMask)");
+        }
+        if (policy.nIdealProcessor >= 0)
+            m_dwPreviousIdealProcessor = SetThreadIdealProcessor(m_hThread, (DWORD)policy.nIdealProcessor);
+
+        // MMCSS is missing on some server installations and disabled in some sessions
+        const AvrtFunctions& avrt = GetAvrtFunctions();
+        if (policy.lpMmcssTask != nullptr && avrt.pfnSetCharacteristics)
+        {
+            m_hMmcss = avrt.pfnSetCharacteristics(policy.lpMmcssTask, &m_dwMmcssTask);
+            if (m_hMmcss != NULL)
+                avrt.pfnSetPriority(m_hMmcss, policy.mmcssPriority);
+        }
+        if (m_hMmcss == NULL && !SetThreadPriority(m_hThread, policy.nPriority))
+        {
+            if (m_dwPreviousIdealProcessor != (DWORD)-1)
+                SetThreadIdealProcessor(m_hThread, m_dwPreviousIdealProcessor);
+            if (m_ullPreviousAffinity != 0)
+                SetThreadAffinityMask(m_hThread, m_ullPreviousAffinity);
+            throw ApplicationException(L"Failed to set the thread priority (SetThreadPriority)");
+        }
+    }
+
+    ThreadSchedule::~ThreadSchedule()
+    {
+        if (m_hMmcss != NULL)
+            GetAvrtFunctions().pfnRevert(m_hMmcss);
+        if (m_nPreviousPriority != THREAD_PRIORITY_ERROR_RETURN)
+            SetThreadPriority(m_hThread, m_nPreviousPriority);
+        if (m_dwPreviousIdealProcessor != (DWORD)-1)
+            SetThreadIdealProcessor(m_hThread, m_dwPreviousIdealProcessor);
+        if (m_ullPreviousAffinity != 0)
+            SetThreadAffinityMask(m_hThread, m_ullPreviousAffinity);
+    }
+
+    void JitterMeter::Record(LONGLONG llExpected, LONGLONG llActual)
+    {
+        m_fSamples[m_uNext] = (float)((double)(std::max)(llActual - llExpected, 0LL) * m_dTicksToMs);
+        m_uNext = (m_uNext + 1) % s_uSamples;
+        m_uCount = (std::min)(m_uCount + 1, s_uSamples);
+    }
+
+    float JitterMeter::GetLast() const
+    {
+        return m_uCount ? m_fSamples[(m_uNext + s_uSamples - 1) % s_uSamples] : 0.0f;
+    }
+
+    float JitterMeter::GetMean() const
+    {
+        if (m_uCount == 0)
+            return 0.0f;
+
+        double dSum = 0.0;
+        for (UINT i = 0; i < m_uCount; i++)
+            dSum += m_fSamples[i];
+        return (float)(dSum / m_uCount);
+    }
+
+    float JitterMeter::GetMax() const
+    {
+        float fMax = 0.0f;
+        for (UINT i = 0; i < m_uCount; i++)
+            fMax = (std::max)(fMax, m_fSamples[i]);
+        return fMax;
+    }
+
+    float JitterMeter::GetPercentile(float fPercentile) const
+    {
+        if (m_uCount == 0)
+            return 0.0f;
+
+        float fSorted[s_uSamples];
+        std::copy(m_fSamples, m_fSamples + m_uCount, fSorted);
+        UINT uIndex = (std::min)((UINT)(fPercentile / 100.0f * (float)m_uCount), m_uCount - 1);
+        std::nth_element(fSorted, fSorted + uIndex, fSorted + m_uCount);
+        return fSorted[uIndex];
+    }
+
+    /*=========================================================================
+     * PreciseTimer implementation
+     *=========================================================================*/
+    PreciseTimer::PreciseTimer()
+    {
+        m_hTimer = CreateWaitableTimerExW(NULL, NULL, CREATE_WAITABLE_TIMER_HIGH_RESOLUTION, TIMER_ALL_ACCESS);
+        if (m_hTimer == NULL)
+        {
+            m_bHighResolution = FALSE;
+            m_hTimer = CreateWaitableTimerExW(NULL, NULL, 0, TIMER_ALL_ACCESS);
+            if (m_hTimer == NULL)
+                throw ApplicationException(L"Failed to create the timer (CreateWaitableTimerExW)");
+        }
+
+        // Spinning is capped at 4 ms, a coarse timer trades precision for CPU time past that
+        m_llFrequency = QpcClock::GetFrequency();
+        m_llMinSpinTail = m_llFrequency / 20000;
+        m_llMaxSpinTail = m_llFrequency / 250;
+        m_dLateMean = (double)(m_bHighResolution ? m_llFrequency / 1000 : m_llMaxSpinTail);
+        m_llSpinTail = (LONGLONG)m_dLateMean;
+    }
+
+    PreciseTimer::~PreciseTimer()
+    {
+        CloseHandle(m_hTimer);
+    }
+
+    void PreciseTimer::SleepUntil(LONGLONG llDeadline)
+    {
+        if (Arm(llDeadline) && WaitForSingleObject(m_hTimer, INFINITE) != WAIT_OBJECT_0)
+            throw ApplicationException(L"Failed to wait for the timer (WaitForSingleObject)");
+        Finish(llDeadline);
+    }
+
+    BOOL PreciseTimer::Arm(LONGLONG llDeadline)
+    {
+        m_llArmed = 0;
+        LONGLONG llWake = llDeadline - m_llSpinTail;
+        LONGLONG llNow = QpcClock::Now();
+        if (llWake <= llNow)
+            return FALSE;
+
+        // Negative due times are relative, in 100 ns units
+        LARGE_INTEGER liDueTime = {};
+        liDueTime.QuadPart = -(LONGLONG)((double)(llWake - llNow) * 10000000.0 / (double)m_llFrequency);
+        if (!SetWaitableTimer(m_hTimer, &liDueTime, 0, NULL, NULL, FALSE))
+            throw ApplicationException(L"Failed to set the timer (SetWaitableTimer)");
+
+        m_llArmed = llWake;
+        return TRUE;
+    }
+
+    void PreciseTimer::Finish(LONGLONG llDeadline)
+    {
+        LONGLONG llNow = QpcClock::Now();
+        if (m_llArmed != 0)
+        {
+            // The tail covers the mean lateness plus three deviations, adapting over about 16 sleeps
+            constexpr double dWeight = 1.0 / 16.0;
+            double dDelta = (double)(llNow - m_llArmed) - m_dLateMean;
+            m_dLateMean += dWeight * dDelta;
+            m_dLateVariance = (1.0 - dWeight) * (m_dLateVariance + dWeight * dDelta * dDelta);
+            m_llSpinTail = (std::min)((std::max)((LONGLONG)(m_dLateMean + 3.0 * std::sqrt(m_dLateVariance)),
+                m_llMinSpinTail), m_llMaxSpinTail);
+            m_llArmed = 0;
+        }
+
+        for (; llNow < llDeadline; llNow = QpcClock::Now())
+            YieldProcessor();
+    }
+
+    /*=========================================================================
+     * StartupTimeline implementation
+     *=========================================================================*/
+    void StartupTimeline::Mark(LPCWSTR lpName, LONGLONG llTimestamp)
+    {
+        Entry entry = { lpName, llTimestamp - m_llStart };
+        auto it = std::upper_bound(m_entries.begin(), m_entries.end(), entry.llTicks,
+            [](LONGLONG llTicks, const Entry& other) { return llTicks < other.llTicks; });
+        m_entries.insert(it, std::move(entry));
+    }
+
+    void StartupTimeline::MarkProcessStart()
+    {
+        FILETIME ftCreation = {}, ftExit = {}, ftKernel = {}, ftUser = {}, ftNow = {};
+        if (!GetProcessTimes(GetCurrentProcess(), &ftCreation, &ftExit, &ftKernel, &ftUser))
+            return;
+        GetSystemTimePreciseAsFileTime(&ftNow);
+        LONGLONG llNow = QpcClock::Now();
+
+        // FILETIME counts 100 ns intervals
+        ULARGE_INTEGER uliCreation = { { ftCreation.dwLowDateTime, ftCreation.dwHighDateTime } };
+        ULARGE_INTEGER uliNow = { { ftNow.dwLowDateTime, ftNow.dwHighDateTime } };
+        double dAge = (double)(LONGLONG)(uliNow.QuadPart - uliCreation.QuadPart) / 10000000.0;
+        Mark(L"Process created", llNow - (LONGLONG)(dAge * (double)m_llFrequency));
+    }
+
+    std::wstring StartupTimeline::Format() const
+    {
+        std::wstring text;
+        FormatBuffer<256> line;
+        LONGLONG llPrevious = m_entries.empty() ? 0 : m_entries.front().llTicks;
+        for (const Entry& entry : m_entries)
+        {
+            double dDelta = (double)(entry.llTicks - llPrevious) * 1000.0 / (double)m_llFrequency;
+            line.Clear().AppendFixed(GetMilliseconds(entry), 3).Append(L" ms\t+").AppendFixed(dDelta, 3)
+                .Append(L" ms\t").Append(entry.name.c_str()).Append(L'\n');
+            text.append(line.GetText(), line.GetLength());
+            llPrevious = entry.llTicks;
+        }
+        return text;
+    }
+
+    /*=========================================================================
+     * Application implementation
+     *=========================================================================*/
+    template<class DerivedType, class ClockType>
+    Application<DerivedType, ClockType>::Application(PCWSTR lpWindowName, int nWidth, int nHeight, int x, int y,
+        DWORD dwStyle, DWORD dwExStyle)
+    {
+        m_startupTimeline.MarkProcessStart();
+        m_hInstance = GetModuleHandleW(NULL);
+
+        WNDCLASS wndClass = {};
+        wndClass.lpfnWndProc = DerivedType::WndProc;
+        wndClass.hInstance = m_hInstance;
+        wndClass.lpszClassName = lpWindowName;
+        if (!RegisterClassW(&wndClass))
+            throw ApplicationException(L"Failed to register the window class (RegisterClassW)");
+        m_startupTimeline.Mark(L"Window class registered");
+
+        m_hWnd = CreateWindowExW(dwExStyle, lpWindowName, lpWindowName, dwStyle, x, y,
+            nWidth, nHeight, NULL, NULL, m_hInstance, this);
+        if (m_hWnd == nullptr)
+            throw ApplicationException(L"Failed to create a window (CreateWindowEx)");
+        m_startupTimeline.Mark(L"Window created");
+
+        // A cloaked window is laid out and painted like a visible one without reaching the screen, it is
+        // shown directly when the compositor does not support cloaking
+        BOOL bCloak = TRUE;
+        m_bCloaked = SUCCEEDED(DwmSetWindowAttribute(m_hWnd, DWMWA_CLOAK, &bCloak, sizeof(bCloak)));
+        ShowWindow(m_hWnd, SW_SHOW);
+    }
+
+    template<class DerivedType, class ClockType>
+    LRESULT CALLBACK Application<DerivedType, ClockType>::WndProc(HWND hWnd, UINT uMsg, WPARAM wParam, LPARAM lParam)
+    {
+        DerivedType* pDerivedType = NULL;
+
+        if (uMsg == WM_NCCREATE)
+        {
+            CREATESTRUCT* pCreate = (CREATESTRUCT*)lParam;
+            pDerivedType = (DerivedType*)pCreate->lpCreateParams;
+            SetWindowLongPtr(hWnd, GWLP_USERDATA, (LONG_PTR)pDerivedType);
+
+            pDerivedType->m_hWnd = hWnd;
+        }
+        else
+        {
+            pDerivedType = (DerivedType*)GetWindowLongPtr(hWnd, GWLP_USERDATA);
+        }
+
+        if (pDerivedType)
+        {
+            // Messages sent from a handler must not leave their timestamp to the handler that sent them
+            struct EventTimeScope
+            {
+                EventTime& eventTime;
+                EventTime previous;
+                ~EventTimeScope() { eventTime = previous; }
+            } eventTimeScope = { pDerivedType->m_eventTime, pDerivedType->m_eventTime };
+
+            const MSG& dispatched = pDerivedType->m_dispatched;
+            if (uMsg != dispatched.message || hWnd != dispatched.hwnd || wParam != dispatched.wParam || lParam != dispatched.lParam)
+                pDerivedType->m_eventTime = { ClockType::Now(), (DWORD)GetMessageTime() };
+
+            // Registered messages are not constants, they cannot be switch cases. Applications without
+            // a GamepadPoller never register this one
+            UINT uGamepadMessage = PeekGamepadMessage();
+            if (uGamepadMessage != 0 && uMsg == uGamepadMessage)
+            {
+                UINT uPad = LOWORD(wParam);
+                if (HIWORD(wParam) == GamepadPoller<>::Buttons)
+                    pDerivedType->OnGamepadButtons(uPad, LOWORD(lParam), HIWORD(lParam));
+                else
+                    pDerivedType->OnGamepadConnection(uPad, HIWORD(wParam) == GamepadPoller<>::Connected);
+                return TRUE;
+            }
+
+            switch (uMsg)
+            {
             // Painting handling
             case WM_PAINT:
             {
-                PAINTSTRUCT ps = {};
-                HDC hDC = BeginPaint(hWnd, &ps);
-                pDerivedType->OnPaint(hDC, ps);
-                EndPaint(hWnd, &ps);
+                PAINTSTRUCT ps = {};
+                HDC hDC = BeginPaint(hWnd, &ps);
+                pDerivedType->OnPaint(hDC, ps);
+                EndPaint(hWnd, &ps);
+
+                if (!pDerivedType->m_bFirstFrameShown)
+                {
+                    if (pDerivedType->m_bCloaked)
+                    {
+                        BOOL bCloak = FALSE;
+                        DwmSetWindowAttribute(hWnd, DWMWA_CLOAK, &bCloak, sizeof(bCloak));
+                        pDerivedType->m_bCloaked = FALSE;
+                    }
+                    pDerivedType->m_bFirstFrameShown = TRUE;
+                    pDerivedType->m_startupTimeline.Mark(L"First frame");
+                }
+            }
+            return TRUE;
+
+            // Keyboard handling
+            case WM_KEYDOWN: pDerivedType->OnKeyDown(wParam); return TRUE;
+            case WM_KEYUP: pDerivedType->OnKeyUp(wParam); return TRUE;
+
+            // Mouse handling
+            case WM_LBUTTONDOWN: pDerivedType->OnMouseButtonDown(VK_LBUTTON); return TRUE;
+            case WM_MBUTTONDOWN: pDerivedType->OnMouseButtonDown(VK_MBUTTON); return TRUE;
+            case WM_RBUTTONDOWN: pDerivedType->OnMouseButtonDown(VK_RBUTTON); return TRUE;
+            case WM_LBUTTONUP: pDerivedType->OnMouseButtonUp(VK_LBUTTON); return TRUE;
+            case WM_MBUTTONUP: pDerivedType->OnMouseButtonUp(VK_MBUTTON); return TRUE;
+            case WM_RBUTTONUP: pDerivedType->OnMouseButtonUp(VK_RBUTTON); return TRUE;
+            case WM_MOUSEMOVE:
+            {
+                int x = GET_X_LPARAM(lParam);
+                int y = GET_Y_LPARAM(lParam);
+                if (pDerivedType->m_bPointerPrediction)
+                    pDerivedType->m_pointerPredictor.AddSample((float)x, (float)y, pDerivedType->m_eventTime.llTimestamp);
+                pDerivedType->OnMouseMove(x, y);
+            }
+            return TRUE;
+
+            // Close handling
+            case WM_CLOSE:
+            {
+                pDerivedType->OnClose();
+                PostQuitMessage(0);
+            }
+            return TRUE;
+
+            // Pointer handling, other messages handlers still see the pointer messages SWL did not consume
+            case WM_POINTERDOWN:
+            case WM_POINTERUPDATE:
+            case WM_POINTERUP:
+            case WM_POINTERCAPTURECHANGED:
+                if (uMsg == WM_POINTERCAPTURECHANGED)
+                    pDerivedType->m_pointerContacts.Remove(GET_POINTERID_WPARAM(wParam));
+                else if (pDerivedType->HandlePointer(GET_POINTERID_WPARAM(wParam)))
+                    return TRUE;
+                [[fallthrough]];
+
+            // Handle other messages that are not handled by SWL
+            default:
+                if (pDerivedType->HandleOtherMessages(uMsg))
+                    return TRUE;
+            }
+        }
+
+        return DefWindowProc(hWnd, uMsg, wParam, lParam);
+    }
+
+    template<class DerivedType, class ClockType>
+    void Application<DerivedType, ClockType>::RunFrame()
+    {
+        MSG msg = {};
+        UINT32 uMessages = 0;
+        for (; PeekMessageW(&msg, NULL, 0, 0, PM_REMOVE); uMessages++)
+            Dispatch(msg);
+        EndPump(uMessages);
+
+        // Nothing is rendered for hidden windows or when no frame was requested
+        if (!m_bFrameRequested || IsIconic(m_hWnd) || !IsWindowVisible(m_hWnd))
+        {
+            m_metrics.RecordIdle();
+            WaitMessageOrObjects(NULL, 0);
+            return;
+        }
+
+        // Rendering may request the next frame, like an animation would
+        LARGE_INTEGER liStart = {}, liRendered = {}, liPresented = {};
+        if (m_metrics.IsEnabled())
+            QueryPerformanceCounter(&liStart);
+        m_bFrameRequested = FALSE;
+        RedrawWindow(m_hWnd, NULL, NULL, RDW_INVALIDATE | RDW_UPDATENOW);
+        if (m_metrics.IsEnabled())
+            QueryPerformanceCounter(&liRendered);
+
+        if (m_llFrameInterval > 0)
+        {
+            WaitFrameDeadline();
+            if (m_bJitterMeter)
+                m_jitterMeter.Record(m_llFrameDeadline, QpcClock::Now());
+        }
+        else
+        {
+            // Block until the compositor consumed the frame so rendering never runs ahead of the display
+            LONGLONG llVBlank = 0, llRefreshPeriod = 0;
+            BOOL bJitter = m_bJitterMeter && GetCompositionTiming(&llVBlank, &llRefreshPeriod);
+            DwmFlush();
+            if (bJitter)
+                m_jitterMeter.Record(llVBlank, QpcClock::Now());
+        }
+        if (m_metrics.IsEnabled())
+        {
+            QueryPerformanceCounter(&liPresented);
+            m_metrics.RecordFrame(liRendered.QuadPart - liStart.QuadPart, liPresented.QuadPart);
+        }
+    }
+
+    template<class DerivedType, class ClockType>
+    void Application<DerivedType, ClockType>::SetFrameRate(double dFramesPerSecond)
+    {
+        m_llFrameInterval = dFramesPerSecond > 0.0 ? (LONGLONG)((double)QpcClock::GetFrequency() / dFramesPerSecond) : 0;
+        m_llFrameDeadline = QpcClock::Now();
+    }
+
+    template<class DerivedType, class ClockType>
+    void Application<DerivedType, ClockType>::WaitFrameDeadline()
+    {
+        // A late frame skips the deadlines it missed rather than rendering a burst to catch up
+        m_llFrameDeadline += m_llFrameInterval;
+        LONGLONG llNow = QpcClock::Now();
+        if (m_llFrameDeadline <= llNow)
+            m_llFrameDeadline += ((llNow - m_llFrameDeadline) / m_llFrameInterval + 1) * m_llFrameInterval;
+
+        if (m_frameTimer.Arm(m_llFrameDeadline))
+        {
+            // Messages keep being dispatched until the timer fires
+            HANDLE hTimer = m_frameTimer.GetHandle();
+            DWORD dwResult = 0;
+            do
+                dwResult = WaitMessageOrObjects(&hTimer, 1);
+            while (dwResult != 0);
+        }
+        m_frameTimer.Finish(m_llFrameDeadline);
+    }
+
+    template<class DerivedType, class ClockType>
+    BOOL Application<DerivedType, ClockType>::GetCompositionTiming(LONGLONG* pllNextVBlank, LONGLONG* pllRefreshPeriod) const
+    {
+        DWM_TIMING_INFO timingInfo = {};
+        timingInfo.cbSize = sizeof(timingInfo);
+        if (FAILED(DwmGetCompositionTimingInfo(NULL, &timingInfo)))
+            return FALSE;
+
+        *pllNextVBlank = (LONGLONG)timingInfo.qpcVBlank;
+        *pllRefreshPeriod = (LONGLONG)timingInfo.qpcRefreshPeriod;
+
+        // qpcVBlank may already be in the past, move it to the upcoming one
+        LARGE_INTEGER liNow = {};
+        QueryPerformanceCounter(&liNow);
+        if (*pllRefreshPeriod > 0 && *pllNextVBlank <= liNow.QuadPart)
+            *pllNextVBlank += ((liNow.QuadPart - *pllNextVBlank) / *pllRefreshPeriod + 1) * *pllRefreshPeriod;
+
+        return TRUE;
+    }
+
+    template<class DerivedType, class ClockType>
+    void Application<DerivedType, ClockType>::Dispatch(const MSG& msg)
+    {
+        // WndProc recognizes the message and keeps the timestamp taken at retrieval. Both are restored
+        // afterwards, for messages pumped by a modal loop running inside a handler
+        MSG previousDispatched = m_dispatched;
+        EventTime previousEventTime = m_eventTime;
+        m_dispatched = msg;
+        m_eventTime = { ClockType::Now(), msg.time };
+
+        LARGE_INTEGER liStart = {}, liEnd = {};
+        if (m_metrics.IsEnabled())
+            QueryPerformanceCounter(&liStart);
+        TranslateMessage(&msg);
+        DispatchMessageW(&msg);
+        if (m_metrics.IsEnabled())
+        {
+            QueryPerformanceCounter(&liEnd);
+            m_metrics.RecordDispatch(liEnd.QuadPart - liStart.QuadPart);
+        }
+        m_dispatched = previousDispatched;
+        m_eventTime = previousEventTime;
+    }
+
+    template<class DerivedType, class ClockType>
+    void Application<DerivedType, ClockType>::EndPump(UINT32 uMessages)
+    {
+        OnPump();
+        if (m_metrics.IsEnabled())
+        {
+            m_metrics.RecordPump(uMessages);
+            m_metrics.Publish();
+        }
+    }
+
+    template<class DerivedType, class ClockType>
+    BOOL Application<DerivedType, ClockType>::GetPredictedPointer(float* px, float* py) const
+    {
+        // A frame rendered now is composed at the next vertical blank and scanned out during the following one
+        LONGLONG llNow = ClockType::Now();
+        LONGLONG llTarget = llNow;
+        LONGLONG llNextVBlank = 0, llRefreshPeriod = 0;
+        if (GetCompositionTiming(&llNextVBlank, &llRefreshPeriod))
+            llTarget = QpcToClock(llNextVBlank + llRefreshPeriod);
+        return m_pointerPredictor.Predict(llNow, llTarget, px, py);
+    }
+
+    template<class DerivedType, class ClockType>
+    LONGLONG Application<DerivedType, ClockType>::QpcToClock(LONGLONG llQpc)
+    {
+        if constexpr (std::is_same_v<ClockType, QpcClock>)
+            return llQpc;
+        else
+            return ClockType::Now() + (LONGLONG)((double)(llQpc - QpcClock::Now()) * ClockType::GetFrequency() / QpcClock::GetFrequency());
+    }
+
+    template<class DerivedType, class ClockType>
+    void Application<DerivedType, ClockType>::AddPointerSample(const POINTER_INFO& info, float fPressure, float fTiltX,
+        float fTiltY, float fRotation, UINT32 uPenFlags)
+    {
+        POINT ptClient = info.ptPixelLocation;
+        ScreenToClient(m_hWnd, &ptClient);
+
+        PointerSample sample = {};
+        sample.uPointerId = info.pointerId;
+        sample.type = info.pointerType;
+        sample.dwFlags = info.pointerFlags;
+        sample.uPenFlags = uPenFlags;
+        sample.llTimestamp = info.PerformanceCount ? QpcToClock((LONGLONG)info.PerformanceCount) : m_eventTime.llTimestamp;
+        sample.x = (float)ptClient.x;
+        sample.y = (float)ptClient.y;
+        sample.fPressure = fPressure;
+        sample.fTiltX = fTiltX;
+        sample.fTiltY = fTiltY;
+        sample.fRotation = fRotation;
+        m_pointerSamples.push_back(sample);
+    }
+
+    template<class DerivedType, class ClockType>
+    BOOL Application<DerivedType, ClockType>::HandlePointer(UINT32 uPointerId)
+    {
+        // The latest sample tells how many are coalesced, the history comes newest first
+        POINTER_INFO info = {};
+        if (!GetPointerInfo(uPointerId, &info))
+            return FALSE;
+        UINT32 uCount = (std::max)(info.historyCount, 1u);
+        m_pointerSamples.clear();
+
+        if (info.pointerType == PT_PEN)
+        {
+            m_penHistory.resize(uCount);
+            if (!GetPointerPenInfoHistory(uPointerId, &uCount, m_penHistory.data()))
+                return FALSE;
+            for (UINT32 i = uCount; i-- > 0;)
+            {
+                const POINTER_PEN_INFO& pen = m_penHistory[i];
+                float fPressure = (pen.penMask & PEN_MASK_PRESSURE) ? pen.pressure / 1024.0f
+                    : (pen.pointerInfo.pointerFlags & POINTER_FLAG_INCONTACT) ? 1.0f : 0.0f;
+                AddPointerSample(pen.pointerInfo, fPressure, (pen.penMask & PEN_MASK_TILT_X) ? (float)pen.tiltX : 0.0f,
+                    (pen.penMask & PEN_MASK_TILT_Y) ? (float)pen.tiltY : 0.0f,
+                    (pen.penMask & PEN_MASK_ROTATION) ? (float)pen.rotation : 0.0f, pen.penFlags);
+            }
+        }
+        else if (info.pointerType == PT_TOUCH)
+        {
+            m_touchHistory.resize(uCount);
+            if (!GetPointerTouchInfoHistory(uPointerId, &uCount, m_touchHistory.data()))
+                return FALSE;
+            for (UINT32 i = uCount; i-- > 0;)
+            {
+                const POINTER_TOUCH_INFO& touch = m_touchHistory[i];
+                float fPressure = (touch.touchMask & TOUCH_MASK_PRESSURE) ? touch.pressure / 1024.0f
+                    : (touch.pointerInfo.pointerFlags & POINTER_FLAG_INCONTACT) ? 1.0f : 0.0f;
+                AddPointerSample(touch.pointerInfo, fPressure, 0.0f, 0.0f, 0.0f, 0);
+            }
+        }
+        else
+        {
+            m_pointerHistory.resize(uCount);
+            if (!GetPointerInfoHistory(uPointerId, &uCount, m_pointerHistory.data()))
+                return FALSE;
+            for (UINT32 i = uCount; i-- > 0;)
+            {
+                const POINTER_INFO& pointer = m_pointerHistory[i];
+                AddPointerSample(pointer, (pointer.pointerFlags & POINTER_FLAG_INCONTACT) ? 1.0f : 0.0f, 0.0f, 0.0f, 0.0f, 0);
+            }
+        }
+
+        m_pointerContacts.Update(m_pointerSamples.data(), (UINT)m_pointerSamples.size());
+        return OnPointer(m_pointerSamples.data(), (UINT)m_pointerSamples.size());
+    }
+
+    template<class DerivedType, class ClockType>
+    void Application<DerivedType, ClockType>::WaitMessage()
+    {
+        MSG msg = {};
+        if (GetMessageW(&msg, NULL, 0, 0) == -1)
+            throw ApplicationException(L"Failed to get a message (GetMessageW)");
+        Dispatch(msg);
+        EndPump(1);
+    }
+
+    template<class DerivedType, class ClockType>
+    void Application<DerivedType, ClockType>::PollMessage()
+    {
+        MSG msg = {};
+        UINT32 uMessages = 0;
+        if (PeekMessageW(&msg, NULL, 0, 0, PM_REMOVE))
+        {
+            Dispatch(msg);
+            uMessages = 1;
+        }
+        EndPump(uMessages);
+    }
+
+    template<class DerivedType, class ClockType>
+    DWORD Application<DerivedType, ClockType>::WaitMessageOrObjects(const HANDLE* pHandles, DWORD nCount, DWORD dwMilliseconds)
+    {
+        DWORD dwResult = MsgWaitForMultipleObjectsEx(nCount, pHandles, dwMilliseconds, QS_ALLINPUT,
+            MWMO_INPUTAVAILABLE);
+        if (dwResult == WAIT_FAILED)
+            throw ApplicationException(L"Failed to wait for messages (MsgWaitForMultipleObjectsEx)");
+        if (dwResult == WAIT_TIMEOUT)
+            return WAIT_TIMEOUT;
+        if (dwResult < WAIT_OBJECT_0 + nCount)
+            return dwResult - WAIT_OBJECT_0;
+
+        MSG msg = {};
+        UINT32 uMessages = 0;
+        for (; PeekMessageW(&msg, NULL, 0, 0, PM_REMOVE); uMessages++)
+            Dispatch(msg);
+        EndPump(uMessages);
+
+        return nCount;
+    }
+
+    /*=========================================================================
+     * EventBus implementation
+     *=========================================================================*/
+    template<class... EventTypes>
+    template<auto pfnMethod>
+    void EventBus<EventTypes...>::InvokeMethod(void* pContext,
+        const typename MethodTraits<decltype(pfnMethod)>::Event& event)
+    {
+        using ObjectType = typename MethodTraits<decltype(pfnMethod)>::Object;
+        (static_cast<ObjectType*>(pContext)->*pfnMethod)(event);
+    }
+
+    template<class... EventTypes>
+    template<class EventType>
+    typename EventBus<EventTypes...>::template Channel<EventType>& EventBus<EventTypes...>::GetChannel()
+    {
+        static_assert((std::is_same_v<EventType, EventTypes> || ...),
+            "The event type is not registered in this EventBus");
+        return std::get<Channel<EventType>>(m_channels);
+    }
+
+    template<class... EventTypes>
+    template<class EventType>
+    void EventBus<EventTypes...>::FlushChannel()
+    {
+        Channel<EventType>& channel = GetChannel<EventType>();
+
+        // Events posted while delivering are kept for the next flush
+        channel.delivering.swap(channel.deferred);
+        size_t i = 0;
+        try
+        {
+            for (; i < channel.delivering.size(); i++)
+                Publish(channel.delivering[i]);
+        }
+        catch (...)
+        {
+            // The event that threw counts as delivered, the following ones go back ahead of those posted meanwhile
+            channel.deferred.insert(channel.deferred.begin(), std::make_move_iterator(channel.delivering.begin() + i + 1),
+                std::make_move_iterator(channel.delivering.end()));
+            channel.delivering.clear();
+            throw;
+        }
+        channel.delivering.clear();
+    }
+
+    template<class... EventTypes>
+    template<class EventType>
+    void EventBus<EventTypes...>::Subscribe(void (*pfnHandler)(void*, const EventType&), void* pContext)
+    {
+        GetChannel<EventType>().subscribers.push_back({ pContext, pfnHandler });
+    }
+
+    template<class... EventTypes>
+    template<auto pfnMethod>
+    void EventBus<EventTypes...>::Subscribe(typename MethodTraits<decltype(pfnMethod)>::Object* pObject)
+    {
+        Subscribe(&EventBus::InvokeMethod<pfnMethod>, static_cast<void*>(pObject));
+    }
+
+    template<class... EventTypes>
+    template<class EventType>
+    void EventBus<EventTypes...>::Unsubscribe(void (*pfnHandler)(void*, const EventType&), void* pContext)
+    {
+        Channel<EventType>& channel = GetChannel<EventType>();
+        std::vector<Subscriber<EventType>>& subscribers = channel.subscribers;
+        for (size_t i = 0; i < subscribers.size(); i++)
+        {
+            if (subscribers[i].pfnHandler == pfnHandler && subscribers[i].pContext == pContext)
+            {
+                // Erasing while publishing would shift the next subscriber under the loop index
+                if (channel.uPublishing > 0)
+                {
+                    subscribers[i].pfnHandler = nullptr;
+                    channel.bRemoved = TRUE;
+                }
+                else
+                {
+                    subscribers.erase(subscribers.begin() + i);
+                }
+                return;
+            }
+        }
+    }
+
+    template<class... EventTypes>
+    template<auto pfnMethod>
+    void EventBus<EventTypes...>::Unsubscribe(typename MethodTraits<decltype(pfnMethod)>::Object* pObject)
+    {
+        Unsubscribe(&EventBus::InvokeMethod<pfnMethod>, static_cast<void*>(pObject));
+    }
+
+    template<class... EventTypes>
+    template<class EventType>
+    void EventBus<EventTypes...>::Publish(const EventType& event)
+    {
+        // Indexed loop as handlers are allowed to subscribe while being called
+        Channel<EventType>& channel = GetChannel<EventType>();
+        std::vector<Subscriber<EventType>>& subscribers = channel.subscribers;
+        channel.uPublishing++;
+        try
+        {
+            for (size_t i = 0; i < subscribers.size(); i++)
+            {
+                Subscriber<EventType> subscriber = subscribers[i];
+                if (subscriber.pfnHandler)
+                    subscriber.pfnHandler(subscriber.pContext, event);
+            }
+        }
+        catch (...)
+        {
+            EndPublish(channel);
+            throw;
+        }
+        EndPublish(channel);
+    }
+
+    template<class... EventTypes>
+    template<class EventType>
+    void EventBus<EventTypes...>::EndPublish(Channel<EventType>& channel)
+    {
+        if (--channel.uPublishing > 0 || !channel.bRemoved)
+            return;
+
+        std::vector<Subscriber<EventType>>& subscribers = channel.subscribers;
+        subscribers.erase(std::remove_if(subscribers.begin(), subscribers.end(),
+            [](const Subscriber<EventType>& subscriber) { return subscriber.pfnHandler == nullptr; }), subscribers.end());
+        channel.bRemoved = FALSE;
+    }
+
+    template<class... EventTypes>
+    template<class EventType>
+    void EventBus<EventTypes...>::Post(EventType event)
+    {
+        GetChannel<EventType>().deferred.push_back(std::move(event));
+    }
+
+    template<class... EventTypes>
+    void EventBus<EventTypes...>::Flush()
+    {
+        if (m_bFlushing)
+            return;
+
+        m_bFlushing = TRUE;
+        try
+        {
+            (FlushChannel<EventTypes>(), ...);
+        }
+        catch (...)
+        {
+            m_bFlushing = FALSE;
+            throw;
+        }
+        m_bFlushing = FALSE;
+    }
+
+    /*=========================================================================
+     * SharedRing implementation
+     *=========================================================================*/
+    void SharedRing::OpenEvent(LPCWSTR lpName, BOOL bCreate)
+    {
+        std::wstring eventName = lpName;
+        eventName += L"_Event";
+
+        if (bCreate)
+            m_hEvent = CreateEventW(NULL, FALSE, FALSE, eventName.c_str());
+        else
+            m_hEvent = OpenEventW(EVENT_MODIFY_STATE | SYNCHRONIZE, FALSE, eventName.c_str());
+        if (m_hEvent == NULL)
+            throw ApplicationException(L"Failed to open the ring event (CreateEventW/OpenEventW)");
+    }
+
+    SharedRing::SharedRing(LPCWSTR lpName, UINT uSlotSize, UINT uSlotCount)
+    {
+        if (lpName == nullptr || lpName[0] == L'\0')
+            throw ApplicationException(L"The ring name must not be empty");
+        if (uSlotCount == 0 || (uSlotCount & (uSlotCount - 1)) != 0)
+            throw ApplicationException(L"The ring slot count must be a power of two");
+
+        // Slots are kept 16 bytes aligned so records can be used in place
+        uSlotSize = (uSlotSize + 15) & ~15u;
+        ULONGLONG ulSize = sizeof(Header) + (ULONGLONG)uSlotSize * uSlotCount;
+
+        m_hMapping = CreateFileMappingW(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE,
+            (DWORD)(ulSize >> 32), (DWORD)ulSize, lpName);
+        if (m_hMapping == NULL)
+            throw ApplicationException(L"Failed to create the ring mapping (CreateFileMappingW)");
+
+        // Initializing an existing ring would reset the positions under its other users
+        if (GetLastError() == ERROR_ALREADY_EXISTS)
+        {
+            CloseHandle(m_hMapping);
+            throw ApplicationException(L"Failed to create the ring mapping, the name is already in use (CreateFileMappingW)");
+        }
+
+        m_pHeader = (Header*)MapViewOfFile(m_hMapping, FILE_MAP_ALL_ACCESS, 0, 0, 0);
+        if (m_pHeader == nullptr)
+        {
+            CloseHandle(m_hMapping);
+            throw ApplicationException(L"Failed to map the ring (MapViewOfFile)");
+        }
+
+        m_pHeader->uSlotSize = uSlotSize;
+        m_pHeader->uSlotCount = uSlotCount;
+        m_pHeader->ulHead.store(0);
+        m_pHeader->ulTail.store(0);
+        m_pHeader->uMagic = s_uMagic;
+        m_pSlots = (BYTE*)m_pHeader + sizeof(Header);
+
+        OpenEvent(lpName, TRUE);
+    }
+
+    SharedRing::SharedRing(LPCWSTR lpName)
+    {
+        if (lpName == nullptr || lpName[0] == L'\0')
+            throw ApplicationException(L"The ring name must not be empty");
+
+        m_hMapping = OpenFileMappingW(FILE_MAP_ALL_ACCESS, FALSE, lpName);
+        if (m_hMapping == NULL)
+            throw ApplicationException(L"Failed to open the ring mapping (OpenFileMappingW)");
+
+        m_pHeader = (Header*)MapViewOfFile(m_hMapping, FILE_MAP_ALL_ACCESS, 0, 0, 0);
+        if (m_pHeader == nullptr || m_pHeader->uMagic != s_uMagic)
+        {
+            if (m_pHeader)
+                UnmapViewOfFile(m_pHeader);
+            CloseHandle(m_hMapping);
+            throw ApplicationException(L"Failed to map the ring (MapViewOfFile)");
+        }
+        m_pSlots = (BYTE*)m_pHeader + sizeof(Header);
+
+        OpenEvent(lpName, FALSE);
+    }
+
+    SharedRing::~SharedRing()
+    {
+        if (m_hEvent)
+            CloseHandle(m_hEvent);
+        UnmapViewOfFile(m_pHeader);
+        CloseHandle(m_hMapping);
+    }
+
+    void* SharedRing::AcquireSlot()
+    {
+        UINT64 ulHead = m_pHeader->ulHead.load(std::memory_order_relaxed);
+        if (ulHead - m_pHeader->ulTail.load(std::memory_order_acquire) >= m_pHeader->uSlotCount)
+            return nullptr;
+
+        return m_pSlots + (ulHead & (m_pHeader->uSlotCount - 1)) * m_pHeader->uSlotSize;
+    }
+
+    void SharedRing::CommitSlot()
+    {
+        UINT64 ulHead = m_pHeader->ulHead.load(std::memory_order_relaxed);
+        m_pHeader->ulHead.store(ulHead + 1);
+
+        // Only wake the consumer on the empty to non-empty transition
+        if (m_pHeader->ulTail.load() == ulHead)
+            SetEvent(m_hEvent);
+    }
+
+    UINT SharedRing::Peek(const void** ppSlots)
+    {
+        UINT64 ulTail = m_pHeader->ulTail.load(std::memory_order_relaxed);
+        UINT64 ulHead = m_pHeader->ulHead.load();
+        UINT uIndex = (UINT)(ulTail & (m_pHeader->uSlotCount - 1));
+
+        // Stop at the end of the mapping so the returned slots are contiguous
+        UINT64 ulCount = ulHead - ulTail;
+        if (ulCount > m_pHeader->uSlotCount - uIndex)
+            ulCount = m_pHeader->uSlotCount - uIndex;
+
+        *ppSlots = m_pSlots + (SIZE_T)uIndex * m_pHeader->uSlotSize;
+        m_ulPending = ulCount;
+        return (UINT)ulCount;
+    }
+
+    void SharedRing::Release(UINT uCount)
+    {
+        if (uCount > m_ulPending)
+            uCount = (UINT)m_ulPending;
+        m_ulPending -= uCount;
+
+        m_pHeader->ulTail.store(m_pHeader->ulTail.load(std::memory_order_relaxed) + uCount);
+    }
+
+    /*=========================================================================
+     * SharedFramebuffer implementation
+     *=========================================================================*/
+    void SharedFramebuffer::CreateBuffers(LPCWSTR lpName, BOOL bCreate)
+    {
+        std::wstring eventName = lpName;
+        eventName += L"_Event";
+
+        if (bCreate)
+            m_hEvent = CreateEventW(NULL, FALSE, FALSE, eventName.c_str());
+        else
+            m_hEvent = OpenEventW(EVENT_MODIFY_STATE | SYNCHRONIZE, FALSE, eventName.c_str());
+        if (m_hEvent == NULL)
+            throw ApplicationException(L"Failed to open the framebuffer event (CreateEventW/OpenEventW)");
+
+        BITMAPINFO bitmapInfo = {};
+        bitmapInfo.bmiHeader.biSize = sizeof(BITMAPINFOHEADER);
+        bitmapInfo.bmiHeader.biWidth = (LONG)m_pHeader->uWidth;
+        bitmapInfo.bmiHeader.biHeight = -(LONG)m_pHeader->uHeight;
+        bitmapInfo.bmiHeader.biPlanes = 1;
+        bitmapInfo.bmiHeader.biBitCount = 32;
+        bitmapInfo.bmiHeader.biCompression = BI_RGB;
+
+        // The DIB sections alias the mapping, nothing is ever copied between processes
+        for (int i = 0; i < 3; i++)
+        {
+            DWORD dwOffset = s_uHeaderSize + i * m_pHeader->uBufferSize;
+            m_hBitmaps[i] = CreateDIBSection(NULL, &bitmapInfo, DIB_RGB_COLORS, &m_pPixels[i], m_hMapping, dwOffset);
+            m_hDCs[i] = CreateCompatibleDC(NULL);
+            if (m_hBitmaps[i] == NULL || m_hDCs[i] == NULL)
+                throw ApplicationException(L"Failed to create a framebuffer bitmap (CreateDIBSection)");
+            m_hOldBitmaps[i] = SelectObject(m_hDCs[i], m_hBitmaps[i]);
+        }
+    }
+
+    void SharedFramebuffer::DestroyBuffers()
+    {
+        for (int i = 0; i < 3; i++)
+        {
+            if (m_hDCs[i])
+            {
+                SelectObject(m_hDCs[i], m_hOldBitmaps[i]);
+                DeleteDC(m_hDCs[i]);
+            }
+            if (m_hBitmaps[i])
+                DeleteObject(m_hBitmaps[i]);
+        }
+        if (m_hEvent)
+            CloseHandle(m_hEvent);
+        if (m_pHeader)
+            UnmapViewOfFile(m_pHeader);
+        if (m_hMapping)
+            CloseHandle(m_hMapping);
+    }
+
+    SharedFramebuffer::SharedFramebuffer(LPCWSTR lpName, int nWidth, int nHeight)
+    {
+        if (lpName == nullptr || lpName[0] == L'\0')
+            throw ApplicationException(L"The framebuffer name must not be empty");
+        if (nWidth <= 0 || nHeight <= 0)
+            throw ApplicationException(L"The framebuffer size must not be empty");
+
+        // The buffers are placed through DWORD offsets, the whole mapping has to stay below 4 GB
+        ULONGLONG ulBufferSize = ((ULONGLONG)nWidth * (ULONGLONG)nHeight * 4 + 4095) & ~4095ull;
+        ULONGLONG ulSize = s_uHeaderSize + ulBufferSize * 3;
+        if (ulSize > MAXDWORD)
+            throw ApplicationException(L"The framebuffer size is too large");
+        UINT32 uBufferSize = (UINT32)ulBufferSize;
+
+        m_hMapping = CreateFileMappingW(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE,
+            (DWORD)(ulSize >> 32), (DWORD)ulSize, lpName);
+        if (m_hMapping == NULL)
+            throw ApplicationException(L"Failed to create the framebuffer mapping (CreateFileMappingW)");
+
+        // Initializing an existing framebuffer would reset the buffer exchange under the renderer
+        if (GetLastError() == ERROR_ALREADY_EXISTS)
+        {
+            CloseHandle(m_hMapping);
+            throw ApplicationException(L"Failed to create the framebuffer mapping, the name is already in use (CreateFileMappingW)");
+        }
+
+        m_pHeader = (Header*)MapViewOfFile(m_hMapping, FILE_MAP_ALL_ACCESS, 0, 0, s_uHeaderSize);
+        if (m_pHeader == nullptr)
+        {
+            DestroyBuffers();
+            throw ApplicationException(L"Failed to map the framebuffer (MapViewOfFile)");
+        }
+
+        m_pHeader->uWidth = (UINT32)nWidth;
+        m_pHeader->uHeight = (UINT32)nHeight;
+        m_pHeader->uBufferSize = uBufferSize;
+        m_pHeader->uMiddle.store(1);
+        m_pHeader->ulSequence.store(0);
+        m_pHeader->uMagic = s_uMagic;
+
+        // The host starts out holding the buffer 2, the renderer the buffer 0
+        m_uIndex = 2;
+
+        try
+        {
+            CreateBuffers(lpName, TRUE);
+        }
+        catch (...)
+        {
+            DestroyBuffers();
+            throw;
+        }
+    }
+
+    SharedFramebuffer::SharedFramebuffer(LPCWSTR lpName)
+    {
+        if (lpName == nullptr || lpName[0] == L'\0')
+            throw ApplicationException(L"The framebuffer name must not be empty");
+
+        m_hMapping = OpenFileMappingW(FILE_MAP_ALL_ACCESS, FALSE, lpName);
+        if (m_hMapping == NULL)
+            throw ApplicationException(L"Failed to open the framebuffer mapping (OpenFileMappingW)");
+
+        m_pHeader = (Header*)MapViewOfFile(m_hMapping, FILE_MAP_ALL_ACCESS, 0, 0, s_uHeaderSize);
+        if (m_pHeader == nullptr || m_pHeader->uMagic != s_uMagic)
+        {
+            DestroyBuffers();
+            throw ApplicationException(L"Failed to map the framebuffer (MapViewOfFile)");
+        }
+
+        m_uIndex = 0;
+
+        try
+        {
+            CreateBuffers(lpName, FALSE);
+        }
+        catch (...)
+        {
+            DestroyBuffers();
+            throw;
+        }
+    }
+
+    SharedFramebuffer::~SharedFramebuffer() { DestroyBuffers(); }
+
+    void SharedFramebuffer::Present()
+    {
+        // Pending GDI drawing must land in the buffer before it is handed over
+        GdiFlush();
+
+        UINT64 ulSequence = m_pHeader->ulSequence.load(std::memory_order_relaxed) + 1;
+        m_pHeader->ulBufferSequence[m_uIndex] = ulSequence;
+        m_uIndex = m_pHeader->uMiddle.exchange(m_uIndex | s_uDirty) & ~s_uDirty;
+        m_pHeader->ulSequence.store(ulSequence);
+
+        SetEvent(m_hEvent);
+    }
+
+    BOOL SharedFramebuffer::Acquire()
+    {
+        if ((m_pHeader->uMiddle.load() & s_uDirty) == 0)
+            return FALSE;
+
+        m_uIndex = m_pHeader->uMiddle.exchange(m_uIndex) & ~s_uDirty;
+        return TRUE;
+    }
+
+    void SharedFramebuffer::Composite(HDC hDC, int x, int y) const
+    {
+        BitBlt(hDC, x, y, (int)m_pHeader->uWidth, (int)m_pHeader->uHeight, m_hDCs[m_uIndex], 0, 0, SRCCOPY);
+    }
+
+    /*=========================================================================
+     * PngEncoder implementation
+     *=========================================================================*/
+    PngEncoder::PngEncoder(UINT uThreadCount)
+    {
+        m_uThreadCount = uThreadCount ? uThreadCount : (std::max)(1u, std::thread::hardware_concurrency());
+    }
+
+    UINT32 PngEncoder::Crc32(UINT32 uCrc, const BYTE* pData, SIZE_T size)
+    {
+        static const std::array<UINT32, 256> table = []
+        {
+            std::array<UINT32, 256> result{};
+            for (UINT32 i = 0; i < 256; i++)
+            {
+                UINT32 c = i;
+                for (int k = 0; k < 8; k++)
+                    c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+                result[i] = c;
+            }
+            return result;
+        }();
+
+        uCrc = ~uCrc;
+        for (SIZE_T i = 0; i < size; i++)
+            uCrc = table[(uCrc ^ pData[i]) & 0xFF] ^ (uCrc >> 8);
+        return ~uCrc;
+    }
+
+    UINT32 PngEncoder::Adler32(UINT32 uAdler, const BYTE* pData, SIZE_T size)
+    {
+        UINT32 a = uAdler & 0xFFFF;
+        UINT32 b = uAdler >> 16;
+        while (size > 0)
+        {
+            // 5552 is the longest run that cannot overflow before the modulo
+            SIZE_T run = (std::min<SIZE_T>)(size, 5552);
+            size -= run;
+            while (run--)
+            {
+                a += *pData++;
+                b += a;
+            }
+            a %= 65521;
+            b %= 65521;
+        }
+        return a | (b << 16);
+    }
+
+    UINT32 PngEncoder::CombineAdler32(UINT32 uAdler1, UINT32 uAdler2, SIZE_T size2)
+    {
+        const UINT32 uBase = 65521;
+        UINT32 uRem = (UINT32)(size2 % uBase);
+        UINT32 uSum1 = uAdler1 & 0xFFFF;
+        UINT32 uSum2 = (uRem * uSum1) % uBase;
+        uSum1 += (uAdler2 & 0xFFFF) + uBase - 1;
+        uSum2 += (uAdler1 >> 16) + (uAdler2 >> 16) + uBase - uRem;
+        if (uSum1 >= uBase)
+            uSum1 -= uBase;
+        if (uSum1 >= uBase)
+            uSum1 -= uBase;
+        if (uSum2 >= (uBase << 1))
+            uSum2 -= (uBase << 1);
+        if (uSum2 >= uBase)
+            uSum2 -= uBase;
+        return uSum1 | (uSum2 << 16);
+    }
+
+    void PngEncoder::Deflate(const BYTE* pData, SIZE_T size, BOOL bFinal, std::vector<BYTE>& out)
+    {
+        static const UINT16 lengthBase[29] = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+            35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+        static const BYTE lengthExtra[29] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+            3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+        static const UINT16 distanceBase[30] = { 1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+            257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577 };
+
+        // Fixed Huffman codes, stored bit reversed as deflate writes codes from their MSB
+        struct Tables
+        {
+            UINT16 literalCodes[288];
+            BYTE literalLengths[288];
+            BYTE lengthSymbols[259];
+            BYTE distanceCodes[30];
+        };
+        static const Tables tables = []
+        {
+            Tables result{};
+            auto Reverse = [](UINT32 uCode, int nLength)
+            {
+                UINT32 uResult = 0;
+                for (int i = 0; i < nLength; i++)
+                    uResult |= ((uCode >> i) & 1) << (nLength - 1 - i);
+                return (UINT16)uResult;
+            };
+            for (int i = 0; i < 288; i++)
+            {
+                if (i < 144)      { result.literalLengths[i] = 8; result.literalCodes[i] = Reverse(0x30 + i, 8); }
+                else if (i < 256) { result.literalLengths[i] = 9; result.literalCodes[i] = Reverse(0x190 + i - 144, 9); }
+                else if (i < 280) { result.literalLengths[i] = 7; result.literalCodes[i] = Reverse(i - 256, 7); }
+                else              { result.literalLengths[i] = 8; result.literalCodes[i] = Reverse(0xC0 + i - 280, 8); }
+            }
+            for (int i = 0; i < 29; i++)
+                for (int nLength = lengthBase[i]; nLength < 259 && nLength < lengthBase[i] + (1 << lengthExtra[i]); nLength++)
+                    result.lengthSymbols[nLength] = (BYTE)i;
+            for (int i = 0; i < 30; i++)
+                result.distanceCodes[i] = (BYTE)Reverse(i, 5);
+            return result;
+        }();
+
+        UINT64 ulBits = 0;
+        int nBitCount = 0;
+        auto PutBits = [&](UINT32 uValue, int nCount)
+        {
+            ulBits |= (UINT64)uValue << nBitCount;
+            nBitCount += nCount;
+            while (nBitCount >= 8)
+            {
+                out.push_back((BYTE)ulBits);
+                ulBits >>= 8;
+                nBitCount -= 8;
+            }
+        };
+        auto PutLiteral = [&](int nSymbol) { PutBits(tables.literalCodes[nSymbol], tables.literalLengths[nSymbol]); };
+        auto Load32 = [](const BYTE* p) { UINT32 u; memcpy(&u, p, 4); return u; };
+
+        out.reserve(out.size() + size / 2 + 64);
+
+        // Single fixed Huffman block with greedy LZ77 matching on a 4 bytes hash
+        PutBits(bFinal ? 3 : 2, 3);
+
+        std::vector<INT32> hashTable(1 << 15, -1);
+        SIZE_T i = 0;
+        while (i + 4 <= size)
+        {
+            UINT32 uValue = Load32(pData + i);
+            UINT32 uHash = (uValue * 2654435761u) >> 17;
+            INT32 nCandidate = hashTable[uHash];
+            hashTable[uHash] = (INT32)i;
+
+            if (nCandidate >= 0 && i - nCandidate <= 32768 && Load32(pData + nCandidate) == uValue)
+            {
+                SIZE_T maxLength = (std::min<SIZE_T>)(258, size - i);
+                SIZE_T length = 4;
+                while (length < maxLength && pData[nCandidate + length] == pData[i + length])
+                    length++;
+
+                int nLengthSymbol = tables.lengthSymbols[length];
+                PutLiteral(257 + nLengthSymbol);
+                PutBits((UINT32)(length - lengthBase[nLengthSymbol]), lengthExtra[nLengthSymbol]);
+
+                UINT32 uDistance = (UINT32)(i - nCandidate) - 1;
+                int nDistanceCode = (int)uDistance;
+                if (uDistance >= 4)
+                {
+                    int nHighBit = 31;
+                    while ((uDistance >> nHighBit) == 0)
+                        nHighBit--;
+                    nDistanceCode = 2 * nHighBit + ((uDistance >> (nHighBit - 1)) & 1);
+                }
+                PutBits(tables.distanceCodes[nDistanceCode], 5);
+                PutBits(uDistance + 1 - distanceBase[nDistanceCode], nDistanceCode < 4 ? 0 : nDistanceCode / 2 - 1);
+
+                // Only the start of long matches is hashed to keep runs of flat pixels cheap
+                SIZE_T end = (std::min)(i + length, size - 3);
+                for (SIZE_T k = i + 1; k < end && k < i + 16; k++)
+                    hashTable[(Load32(pData + k) * 2654435761u) >> 17] = (INT32)k;
+                i += length;
+            }
+            else
+            {
+                PutLiteral(pData[i]);
+                i++;
+            }
+        }
+        for (; i < size; i++)
+            PutLiteral(pData[i]);
+        PutLiteral(256);
+
+        // Non final blocks end with a sync flush, an empty stored block leaving the stream byte aligned
+        if (!bFinal)
+        {
+            PutBits(0, 3);
+            if (nBitCount > 0)
+                PutBits(0, 8 - nBitCount);
+            PutBits(0x0000, 16);
+            PutBits(0xFFFF, 16);
+        }
+        else if (nBitCount > 0)
+        {
+            PutBits(0, 8 - nBitCount);
+        }
+    }
+
+    void PngEncoder::FilterRow(const BYTE* pRow, const BYTE* pPrior, SIZE_T rowSize, int nBpp,
+        BYTE* pScratch, BYTE* pOut)
+    {
+        // pRow and pPrior are preceded by nBpp zero bytes so the left neighbours can be loaded unconditionally
+        BYTE* pCandidates[5] = { pScratch, pScratch + rowSize, pScratch + rowSize * 2,
+            pScratch + rowSize * 3, pScratch + rowSize * 4 };
+        UINT64 ulCosts[5] = {};
+
+        const __m128i zero = _mm_setzero_si128();
+        const __m128i one = _mm_set1_epi8(1);
+        SIZE_T i = 0;
+        for (; i + 16 <= rowSize; i += 16)
+        {
+            __m128i x = _mm_loadu_si128((const __m128i*)(pRow + i));
+            __m128i a = _mm_loadu_si128((const __m128i*)(pRow + i - nBpp));
+            __m128i b = _mm_loadu_si128((const __m128i*)(pPrior + i));
+            __m128i c = _mm_loadu_si128((const __m128i*)(pPrior + i - nBpp));
+
+            // Average rounds down while _mm_avg_epu8 rounds up
+            __m128i average = _mm_sub_epi8(_mm_avg_epu8(a, b), _mm_and_si128(_mm_xor_si128(a, b), one));
+
+            // Paeth predictor computed on 16-bit lanes
+            __m128i paeth[2];
+            for (int nHalf = 0; nHalf < 2; nHalf++)
+            {
+                __m128i a16 = nHalf ? _mm_unpackhi_epi8(a, zero) : _mm_unpacklo_epi8(a, zero);
+                __m128i b16 = nHalf ? _mm_unpackhi_epi8(b, zero) : _mm_unpacklo_epi8(b, zero);
+                __m128i c16 = nHalf ? _mm_unpackhi_epi8(c, zero) : _mm_unpacklo_epi8(c, zero);
+                __m128i pa = _mm_sub_epi16(b16, c16);
+                __m128i pb = _mm_sub_epi16(a16, c16);
+                __m128i pc = _mm_add_epi16(pa, pb);
+                pa = _mm_max_epi16(pa, _mm_sub_epi16(zero, pa));
+                pb = _mm_max_epi16(pb, _mm_sub_epi16(zero, pb));
+                pc = _mm_max_epi16(pc, _mm_sub_epi16(zero, pc));
+                __m128i useA = _mm_and_si128(_mm_cmplt_epi16(pa, _mm_add_epi16(pb, _mm_set1_epi16(1))),
+                    _mm_cmplt_epi16(pa, _mm_add_epi16(pc, _mm_set1_epi16(1))));
+                __m128i useB = _mm_andnot_si128(useA, _mm_cmplt_epi16(pb, _mm_add_epi16(pc, _mm_set1_epi16(1))));
+                __m128i predictor = _mm_or_si128(_mm_and_si128(useB, b16), _mm_andnot_si128(useB, c16));
+                paeth[nHalf] = _mm_or_si128(_mm_and_si128(useA, a16), _mm_andnot_si128(useA, predictor));
+            }
+
+            __m128i results[5] = {
+                x,
+                _mm_sub_epi8(x, a),
+                _mm_sub_epi8(x, b),
+                _mm_sub_epi8(x, average),
+                _mm_sub_epi8(x, _mm_packus_epi16(paeth[0], paeth[1])),
+            };
+            for (int nFilter = 0; nFilter < 5; nFilter++)
+            {
+                _mm_storeu_si128((__m128i*)(pCandidates[nFilter] + i), results[nFilter]);
+                __m128i magnitude = _mm_min_epu8(results[nFilter], _mm_sub_epi8(zero, results[nFilter]));
+                __m128i sums = _mm_sad_epu8(magnitude, zero);
+                ulCosts[nFilter] += (UINT64)_mm_cvtsi128_si32(sums) + (UINT64)_mm_extract_epi16(sums, 4);
+            }
+        }
+        for (; i < rowSize; i++)
+        {
+            int x = pRow[i];
+            int a = pRow[(SSIZE_T)i - nBpp];
+            int b = pPrior[i];
+            int c = pPrior[(SSIZE_T)i - nBpp];
+            int p = a + b - c;
+            int pa = abs(p - a);
+            int pb = abs(p - b);
+            int pc = abs(p - c);
+            int paeth = (pa <= pb && pa <= pc) ? a : (pb <= pc ? b : c);
+
+            BYTE results[5] = { (BYTE)x, (BYTE)(x - a), (BYTE)(x - b), (BYTE)(x - ((a + b) >> 1)), (BYTE)(x - paeth) };
+            for (int nFilter = 0; nFilter < 5; nFilter++)
+            {
+                pCandidates[nFilter][i] = results[nFilter];
+                ulCosts[nFilter] += (std::min<int>)(results[nFilter], 256 - results[nFilter]);
+            }
+        }
+
+        int nBest = 0;
+        for (int nFilter = 1; nFilter < 5; nFilter++)
+            if (ulCosts[nFilter] < ulCosts[nBest])
+                nBest = nFilter;
+
+        pOut[0] = (BYTE)nBest;
+        memcpy(pOut + 1, pCandidates[nBest], rowSize);
+    }
+
+    void PngEncoder::ConvertRow(const UINT32* pPixels, int nWidth, BOOL bAlpha, BYTE* pOut)
+    {
+        if (bAlpha)
+        {
+            // BGRA to RGBA, swapping the red and blue bytes of each pixel
+            const __m128i greenAlpha = _mm_set1_epi32((int)0xFF00FF00);
+            const __m128i lowByte = _mm_set1_epi32(0xFF);
+            int x = 0;
+            for (; x + 4 <= nWidth; x += 4)
+            {
+                __m128i pixels = _mm_loadu_si128((const __m128i*)(pPixels + x));
+                __m128i result = _mm_or_si128(_mm_and_si128(pixels, greenAlpha),
+                    _mm_or_si128(_mm_and_si128(_mm_srli_epi32(pixels, 16), lowByte),
+                        _mm_slli_epi32(_mm_and_si128(pixels, lowByte), 16)));
+                _mm_storeu_si128((__m128i*)(pOut + x * 4), result);
+            }
+            for (; x < nWidth; x++)
+            {
+                UINT32 uPixel = pPixels[x];
+                pOut[x * 4 + 0] = (BYTE)(uPixel >> 16);
+                pOut[x * 4 + 1] = (BYTE)(uPixel >> 8);
+                pOut[x * 4 + 2] = (BYTE)uPixel;
+                pOut[x * 4 + 3] = (BYTE)(uPixel >> 24);
+            }
+        }
+        else
+        {
+            for (int x = 0; x < nWidth; x++)
+            {
+                UINT32 uPixel = pPixels[x];
+                pOut[x * 3 + 0] = (BYTE)(uPixel >> 16);
+                pOut[x * 3 + 1] = (BYTE)(uPixel >> 8);
+                pOut[x * 3 + 2] = (BYTE)uPixel;
+            }
+        }
+    }
+
+    void PngEncoder::WriteChunk(HANDLE hFile, const char* pType, const BYTE* pData, SIZE_T size)
+    {
+        BYTE header[8] = { (BYTE)(size >> 24), (BYTE)(size >> 16), (BYTE)(size >> 8), (BYTE)size,
+            (BYTE)pType[0], (BYTE)pType[1], (BYTE)pType[2], (BYTE)pType[3] };
+        UINT32 uCrc = Crc32(Crc32(0, header + 4, 4), pData, size);
+        BYTE footer[4] = { (BYTE)(uCrc >> 24), (BYTE)(uCrc >> 16), (BYTE)(uCrc >> 8), (BYTE)uCrc };
+
+        DWORD dwWritten = 0;
+        if (!WriteFile(hFile, header, 8, &dwWritten, NULL)
+            || (size > 0 && !WriteFile(hFile, pData, (DWORD)size, &dwWritten, NULL))
+            || !WriteFile(hFile, footer, 4, &dwWritten, NULL))
+            throw ApplicationException(L"Failed to write the PNG file (WriteFile)");
+    }
+
+    void PngEncoder::Save(LPCWSTR lpFileName, const Surface& surface, BOOL bAlpha)
+    {
+        const int nBpp = bAlpha ? 4 : 3;
+        const SIZE_T rowSize = (SIZE_T)surface.nWidth * nBpp;
+        const int nRowsPerBlock = (std::max)(1, (int)((512 * 1024) / (rowSize + 1)));
+        const int nBlockCount = (surface.nHeight + nRowsPerBlock - 1) / nRowsPerBlock;
+
+        HANDLE hFile = CreateFileW(lpFileName, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS,
+            FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+        if (hFile == INVALID_HANDLE_VALUE)
+            throw ApplicationException(L"Failed to create the PNG file (CreateFileW)");
+
+        std::vector<Block> blocks(nBlockCount);
+        std::vector<BOOL> ready(nBlockCount, FALSE);
+        std::mutex mutex;
+        std::condition_variable condition;
+        std::atomic<int> nNextBlock = 0;
+
+        auto Worker = [&]
+        {
+            // Rows are converted with nBpp leading zero bytes, see FilterRow
+            std::vector<BYTE> rows[2] = { std::vector<BYTE>(rowSize + 16), std::vector<BYTE>(rowSize + 16) };
+            std::vector<BYTE> scratch(rowSize * 5);
+
+            for (int nBlock = nNextBlock++; nBlock < nBlockCount; nBlock = nNextBlock++)
+            {
+                int nFirstRow = nBlock * nRowsPerBlock;
+                int nLastRow = (std::min)(nFirstRow + nRowsPerBlock, surface.nHeight);
+
+                BYTE* pPrior = rows[0].data() + 16;
+                BYTE* pRow = rows[1].data() + 16;
+                memset(rows[0].data(), 0, rows[0].size());
+                memset(rows[1].data(), 0, 16);
+                if (nFirstRow > 0)
+                    ConvertRow(surface.GetRow(nFirstRow - 1), surface.nWidth, bAlpha, pPrior);
+
+                std::vector<BYTE> filtered((rowSize + 1) * (nLastRow - nFirstRow));
+                for (int y = nFirstRow; y < nLastRow; y++)
+                {
+                    ConvertRow(surface.GetRow(y), surface.nWidth, bAlpha, pRow);
+                    FilterRow(pRow, pPrior, rowSize, nBpp, scratch.data(), filtered.data() + (rowSize + 1) * (y - nFirstRow));
+                    std::swap(pRow, pPrior);
+                }
+
+                Block& block = blocks[nBlock];
+                block.size = filtered.size();
+                block.uAdler = Adler32(1, filtered.data(), filtered.size());
+                Deflate(filtered.data(), filtered.size(), nBlock == nBlockCount - 1, block.data);
+
+                std::lock_guard<std::mutex> lock(mutex);
+                ready[nBlock] = TRUE;
+                condition.notify_one();
+            }
+        };
+
+        std::vector<std::thread> threads;
+        UINT uThreadCount = (std::min<UINT>)(m_uThreadCount, (UINT)nBlockCount);
+        for (UINT i = 0; i < uThreadCount; i++)
+            threads.emplace_back(Worker);
+
+        try
+        {
+            static const BYTE signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+            DWORD dwWritten = 0;
+            if (!WriteFile(hFile, signature, 8, &dwWritten, NULL))
+                throw ApplicationException(L"Failed to write the PNG file (WriteFile)");
+
+            BYTE header[13] = {
+                (BYTE)(surface.nWidth >> 24), (BYTE)(surface.nWidth >> 16), (BYTE)(surface.nWidth >> 8), (BYTE)surface.nWidth,
+                (BYTE)(surface.nHeight >> 24), (BYTE)(surface.nHeight >> 16), (BYTE)(surface.nHeight >> 8), (BYTE)surface.nHeight,
+                8, (BYTE)(bAlpha ? 6 : 2), 0, 0, 0 };
+            WriteChunk(hFile, "IHDR", header, sizeof(header));
+
+            // Blocks are streamed in order, the zlib header and checksum wrap the whole sequence
+            UINT32 uAdler = 1;
+            for (int nBlock = 0; nBlock < nBlockCount; nBlock++)
+            {
+                {
+                    std::unique_lock<std::mutex> lock(mutex);
+                    condition.wait(lock, [&] { return ready[nBlock]; });
+                }
+
+                Block& block = blocks[nBlock];
+                uAdler = CombineAdler32(uAdler, block.uAdler, block.size);
+                if (nBlock == 0)
+                    block.data.insert(block.data.begin(), { 0x78, 0x01 });
+                if (nBlock == nBlockCount - 1)
+                    block.data.insert(block.data.end(), { (BYTE)(uAdler >> 24), (BYTE)(uAdler >> 16), (BYTE)(uAdler >> 8), (BYTE)uAdler });
+
+                WriteChunk(hFile, "IDAT", block.data.data(), block.data.size());
+                block.data = {};
+            }
+
+            WriteChunk(hFile, "IEND", nullptr, 0);
+        }
+        catch (...)
+        {
+            nNextBlock = nBlockCount;
+            for (std::thread& thread : threads)
+                thread.join();
+            CloseHandle(hFile);
+            throw;
+        }
+
+        for (std::thread& thread : threads)
+            thread.join();
+        CloseHandle(hFile);
+    }
+
+    /*=========================================================================
+     * Drawing functions implementation
+     *=========================================================================*/
+    struct GammaTables
+    {
+        UINT16 toLinear[256];
+        BYTE toSrgb[4096];
+        UINT32 reciprocal[256];
+
+        static const GammaTables& Get();
+    };
+
+    const GammaTables& GammaTables::Get()
+    {
+        static const GammaTables tables = []
+        {
+            GammaTables result{};
+            for (int i = 0; i < 256; i++)
+            {
+                double dValue = i / 255.0;
+                dValue = dValue <= 0.04045 ? dValue / 12.92 : pow((dValue + 0.055) / 1.055, 2.4);
+                result.toLinear[i] = (UINT16)(dValue * 4095.0 + 0.5);
+
+                // 16.16 factor turning a premultiplied channel back into a straight one
+                result.reciprocal[i] = i ? (UINT32)((255u << 16) / i) : 0;
+            }
+            for (int i = 0; i < 4096; i++)
+            {
+                double dValue = i / 4095.0;
+                dValue = dValue <= 0.0031308 ? dValue * 12.92 : 1.055 * pow(dValue, 1.0 / 2.4) - 0.055;
+                result.toSrgb[i] = (BYTE)(dValue * 255.0 + 0.5);
+            }
+            return result;
+        }();
+        return tables;
+    }
+
+    static void BlendRowOverLinear(UINT32* pDst, const UINT32* pSrc, int nCount)
+    {
+        const GammaTables& tables = GammaTables::Get();
+        const __m128i alphaMask = _mm_set1_epi32((int)0xFF000000);
+
+        int i = 0;
+        while (i < nCount)
+        {
+            // Runs of four opaque or transparent pixels do not need any conversion
+            if (i + 4 <= nCount)
+            {
+                __m128i alpha = _mm_and_si128(_mm_loadu_si128((const __m128i*)(pSrc + i)), alphaMask);
+                if (_mm_movemask_epi8(_mm_cmpeq_epi32(alpha, alphaMask)) == 0xFFFF)
+                {
+                    memcpy(pDst + i, pSrc + i, 16);
+                    i += 4;
+                    continue;
+                }
+                if (_mm_movemask_epi8(_mm_cmpeq_epi32(alpha, _mm_setzero_si128())) == 0xFFFF)
+                {
+                    i += 4;
+                    continue;
+                }
+            }
+
+            UINT32 uSrc = pSrc[i];
+            UINT32 uDst = pDst[i];
+            UINT32 uSrcAlpha = uSrc >> 24;
+            UINT32 uDstAlpha = uDst >> 24;
+            if (uSrcAlpha == 255 || uDstAlpha == 0)
+            {
+                pDst[i] = uSrcAlpha ? uSrc : uDst;
+                i++;
+                continue;
+            }
+
+            // Everything below is done on 12-bit linear premultiplied values
+            UINT32 uInverseAlpha = 255 - uSrcAlpha;
+            UINT32 uOutAlpha = uSrcAlpha + (uDstAlpha * uInverseAlpha + 127) / 255;
+            UINT32 uResult = uOutAlpha << 24;
+            UINT64 ulReciprocal = ((1ull << 32) + 255 * uOutAlpha - 1) / (255 * uOutAlpha);
+            for (int nShift = 0; nShift < 24; nShift += 8)
+            {
+                UINT32 uSrcLinear = tables.toLinear[(std::min)(255u, (((uSrc >> nShift) & 0xFF) * tables.reciprocal[uSrcAlpha] + 0x8000) >> 16)];
+                UINT32 uDstLinear = tables.toLinear[(std::min)(255u, (((uDst >> nShift) & 0xFF) * tables.reciprocal[uDstAlpha] + 0x8000) >> 16)];
+                UINT32 uLinear = (UINT32)(((uSrcLinear * uSrcAlpha * 255 + uDstLinear * uDstAlpha * uInverseAlpha) * ulReciprocal) >> 32);
+                uResult |= ((tables.toSrgb[(std::min)(4095u, uLinear)] * uOutAlpha + 127) / 255) << nShift;
+            }
+            pDst[i] = uResult;
+            i++;
+        }
+    }
+
+    void BlendRowOver(UINT32* pDst, const UINT32* pSrc, int nCount, BlendMode mode)
+    {
+        if (mode == BlendMode::Linear)
+        {
+            BlendRowOverLinear(pDst, pSrc, nCount);
+            return;
+        }
+
+        const __m128i zero = _mm_setzero_si128();
+        const __m128i alphaMask = _mm_set1_epi32((int)0xFF000000);
+        const __m128i half = _mm_set1_epi16(128);
+        const __m128i full = _mm_set1_epi16(255);
+
+        int i = 0;
+        for (; i + 4 <= nCount; i += 4)
+        {
+            __m128i src = _mm_loadu_si128((const __m128i*)(pSrc + i));
+            __m128i alpha = _mm_and_si128(src, alphaMask);
+            int nOpaque = _mm_movemask_epi8(_mm_cmpeq_epi32(alpha, alphaMask));
+            if (nOpaque == 0xFFFF)
+            {
+                _mm_storeu_si128((__m128i*)(pDst + i), src);
+                continue;
+            }
+            if (_mm_movemask_epi8(_mm_cmpeq_epi32(alpha, zero)) == 0xFFFF)
+                continue;
+
+            // d = s + d * (255 - sa) / 255, with x / 255 computed as (x + 128 + ((x + 128) >> 8)) >> 8
+            __m128i dst = _mm_loadu_si128((const __m128i*)(pDst + i));
+            __m128i result[2];
+            for (int nHalf = 0; nHalf < 2; nHalf++)
+            {
+                __m128i src16 = nHalf ? _mm_unpackhi_epi8(src, zero) : _mm_unpacklo_epi8(src, zero);
+                __m128i dst16 = nHalf ? _mm_unpackhi_epi8(dst, zero) : _mm_unpacklo_epi8(dst, zero);
+                __m128i alpha16 = _mm_shufflehi_epi16(_mm_shufflelo_epi16(src16, 0xFF), 0xFF);
+                __m128i product = _mm_add_epi16(_mm_mullo_epi16(dst16, _mm_sub_epi16(full, alpha16)), half);
+                product = _mm_srli_epi16(_mm_add_epi16(product, _mm_srli_epi16(product, 8)), 8);
+                result[nHalf] = _mm_add_epi16(src16, product);
+            }
+            _mm_storeu_si128((__m128i*)(pDst + i), _mm_packus_epi16(result[0], result[1]));
+        }
+        for (; i < nCount; i++)
+        {
+            UINT32 uSrc = pSrc[i];
+            UINT32 uInverseAlpha = 255 - (uSrc >> 24);
+            if (uInverseAlpha == 0)
+            {
+                pDst[i] = uSrc;
+                continue;
+            }
+
+            UINT32 uDst = pDst[i];
+            UINT32 uResult = 0;
+            for (int nShift = 0; nShift < 32; nShift += 8)
+            {
+                UINT32 uProduct = ((uDst >> nShift) & 0xFF) * uInverseAlpha + 128;
+                uProduct = (uProduct + (uProduct >> 8)) >> 8;
+                uResult |= (((uSrc >> nShift) & 0xFF) + uProduct) << nShift;
+            }
+            pDst[i] = uResult;
+        }
+    }
+
+    void CompositeOver(const Surface& dst, int x, int y, const Surface& src, BlendMode mode)
+    {
+        RECT rcDst = { x, y, x + src.nWidth, y + src.nHeight };
+        RECT rcSrc = { 0, 0, src.nWidth, src.nHeight };
+        CompositeScaled(dst, rcDst, src, rcSrc, mode);
+    }
+
+    void CompositeScaled(const Surface& dst, const RECT& rcDst, const Surface& src, const RECT& rcSrc,
+        BlendMode mode)
+    {
+        int nDstWidth = rcDst.right - rcDst.left;
+        int nDstHeight = rcDst.bottom - rcDst.top;
+        int nSrcWidth = rcSrc.right - rcSrc.left;
+        int nSrcHeight = rcSrc.bottom - rcSrc.top;
+        if (nDstWidth <= 0 || nDstHeight <= 0 || nSrcWidth <= 0 || nSrcHeight <= 0)
+            return;
+
+        int nLeft = (std::max)((int)rcDst.left, 0);
+        int nTop = (std::max)((int)rcDst.top, 0);
+        int nRight = (std::min)((int)rcDst.right, dst.nWidth);
+        int nBottom = (std::min)((int)rcDst.bottom, dst.nHeight);
+        if (nLeft >= nRight || nTop >= nBottom)
+            return;
+
+        // 16.16 fixed point steps, sampling at pixel centers
+        INT64 llStepX = ((INT64)nSrcWidth << 16) / nDstWidth;
+        INT64 llStepY = ((INT64)nSrcHeight << 16) / nDstHeight;
+        BOOL bUnscaledX = nSrcWidth == nDstWidth;
+
+        std::vector<UINT32> row;
+        if (!bUnscaledX)
+            row.resize(nRight - nLeft);
+
+        for (int y = nTop; y < nBottom; y++)
+        {
+            int nSrcY = rcSrc.top + (int)(((y - rcDst.top) * llStepY + llStepY / 2) >> 16);
+            const UINT32* pSrcRow = src.GetRow(nSrcY) + rcSrc.left;
+
+            if (bUnscaledX)
+            {
+                BlendRowOver(dst.GetRow(y) + nLeft, pSrcRow + (nLeft - rcDst.left), nRight - nLeft, mode);
+                continue;
+            }
+
+            INT64 llSrcX = (nLeft - rcDst.left) * llStepX + llStepX / 2;
+            for (int x = 0; x < nRight - nLeft; x++, llSrcX += llStepX)
+                row[x] = pSrcRow[llSrcX >> 16];
+            BlendRowOver(dst.GetRow(y) + nLeft, row.data(), nRight - nLeft, mode);
+        }
+    }
+
+    void CompositeNineSlice(const Surface& dst, const RECT& rcDst, const Surface& src, const RECT& rcInsets,
+        BlendMode mode)
+    {
+        LONG srcX[4] = { 0, rcInsets.left, src.nWidth - rcInsets.right, src.nWidth };
+        LONG srcY[4] = { 0, rcInsets.top, src.nHeight - rcInsets.bottom, src.nHeight };
+        LONG dstX[4] = { rcDst.left, rcDst.left + rcInsets.left, rcDst.right - rcInsets.right, rcDst.right };
+        LONG dstY[4] = { rcDst.top, rcDst.top + rcInsets.top, rcDst.bottom - rcInsets.bottom, rcDst.bottom };
+
+        for (int nRow = 0; nRow < 3; nRow++)
+        {
+            for (int nColumn = 0; nColumn < 3; nColumn++)
+            {
+                RECT rcSliceDst = { dstX[nColumn], dstY[nRow], dstX[nColumn + 1], dstY[nRow + 1] };
+                RECT rcSliceSrc = { srcX[nColumn], srcY[nRow], srcX[nColumn + 1], srcY[nRow + 1] };
+                CompositeScaled(dst, rcSliceDst, src, rcSliceSrc, mode);
+            }
+        }
+    }
+
+    void FillMask(const Surface& dst, int x, int y, const BYTE* pMask, int nWidth, int nHeight, int nStride,
+        UINT32 uColor, BlendMode mode)
+    {
+        int nLeft = (std::max)(x, 0);
+        int nRight = (std::min)(x + nWidth, dst.nWidth);
+        if (nLeft >= nRight)
+            return;
+
+        // Red/blue and alpha/green pairs are scaled by the coverage two channels at a time
+        UINT32 uRedBlue = uColor & 0x00FF00FF;
+        UINT32 uAlphaGreen = (uColor >> 8) & 0x00FF00FF;
+        // Rows are blended in chunks through a stack buffer, glyphs being drawn without allocating
+        UINT32 chunk[256];
+        for (int nRow = (std::max)(0, -y); nRow < nHeight && y + nRow < dst.nHeight; nRow++)
+        {
+            const BYTE* pCoverage = pMask + (SIZE_T)nRow * nStride + (nLeft - x);
+            UINT32* pDst = dst.GetRow(y + nRow) + nLeft;
+            for (int nStart = 0; nStart < nRight - nLeft; nStart += (int)std::size(chunk))
+            {
+                int nCount = (std::min)(nRight - nLeft - nStart, (int)std::size(chunk));
+                for (int i = 0; i < nCount; i++)
+                {
+                    UINT32 uCoverage = pCoverage[nStart + i];
+                    UINT32 uLow = uRedBlue * uCoverage + 0x00800080;
+                    UINT32 uHigh = uAlphaGreen * uCoverage + 0x00800080;
+                    uLow = ((uLow + ((uLow >> 8) & 0x00FF00FF)) >> 8) & 0x00FF00FF;
+                    uHigh = (uHigh + ((uHigh >> 8) & 0x00FF00FF)) & 0xFF00FF00;
+                    chunk[i] = uLow | uHigh;
+                }
+                BlendRowOver(pDst + nStart, chunk, nCount, mode);
+            }
+        }
+    }
+
+    // Blurs one row and writes it as a column of the destination, so running it twice blurs both axes
+    static void BoxBlurRowTransposed(const UINT32* pSrc, int nWidth, UINT32* pDst, int nDstStride, int nRadius)
+    {
+        const __m128i zero = _mm_setzero_si128();
+        const __m128 scale = _mm_set1_ps(1.0f / (2 * nRadius + 1));
+        auto Load = [&](int x)
+        {
+            x = (std::min)((std::max)(x, 0), nWidth - 1);
+            return _mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128((int)pSrc[x]), zero), zero);
+        };
+
+        __m128i sum = zero;
+        for (int x = -nRadius; x <= nRadius; x++)
+            sum = _mm_add_epi32(sum, Load(x));
+
+        for (int x = 0; x < nWidth; x++)
+        {
+            __m128i average = _mm_cvtps_epi32(_mm_mul_ps(_mm_cvtepi32_ps(sum), scale));
+            average = _mm_packs_epi32(average, zero);
+            pDst[(SIZE_T)x * nDstStride] = (UINT32)_mm_cvtsi128_si32(_mm_packus_epi16(average, zero));
+
+            sum = _mm_add_epi32(sum, _mm_sub_epi32(Load(x + nRadius + 1), Load(x - nRadius)));
+        }
+    }
+
+    void BoxBlur(const Surface& surface, int nRadius, int nPasses)
+    {
+        if (nRadius <= 0 || surface.nWidth <= 0 || surface.nHeight <= 0)
+            return;
+
+        // The transposed copy is read row by row as well, keeping both passes cache friendly
+        std::vector<UINT32> transposed((SIZE_T)surface.nWidth * surface.nHeight);
+        for (int nPass = 0; nPass < nPasses; nPass++)
+        {
+            for (int y = 0; y < surface.nHeight; y++)
+                BoxBlurRowTransposed(surface.GetRow(y), surface.nWidth, transposed.data() + y, surface.nHeight, nRadius);
+            for (int x = 0; x < surface.nWidth; x++)
+                BoxBlurRowTransposed(transposed.data() + (SIZE_T)x * surface.nHeight, surface.nHeight,
+                    surface.pPixels + x, surface.nStride, nRadius);
+        }
+    }
+
+    /*=========================================================================
+     * ShadowCache implementation
+     *=========================================================================*/
+    ShadowCache::ShadowCache(SIZE_T maxEntries) : m_maxEntries((std::max)(maxEntries, (SIZE_T)1))
+    {
+    }
+
+    const Image& ShadowCache::GetShadow(const Key& key)
+    {
+        for (auto it = m_entries.begin(); it != m_entries.end(); ++it)
+        {
+            if (it->key == key)
+            {
+                m_entries.splice(m_entries.begin(), m_entries, it);
+                return it->image;
+            }
+        }
+
+        // Three box passes spread the shape by three radii on each side
+        int nExtent = key.nRadius * 3;
+        Image shadow(key.nWidth + nExtent * 2, key.nHeight + nExtent * 2);
+
+        const Surface& surface = shadow.GetSurface();
+        for (int y = nExtent; y < nExtent + key.nHeight; y++)
+            std::fill(surface.GetRow(y) + nExtent, surface.GetRow(y) + nExtent + key.nWidth, key.uColor);
+        BoxBlur(surface, key.nRadius);
+
+        // Only cached once rendered, a failure leaves nothing behind
+        if (m_entries.size() >= m_maxEntries)
+            m_entries.pop_back();
+        m_entries.push_front({ key, std::move(shadow) });
+        return m_entries.front().image;
+    }
+
+    void ShadowCache::Draw(const Surface& dst, const RECT& rcShape, int nRadius, UINT32 uColor, BlendMode mode)
+    {
+        int nWidth = rcShape.right - rcShape.left;
+        int nHeight = rcShape.bottom - rcShape.top;
+        if (nWidth <= 0 || nHeight <= 0)
+            return;
+
+        // Past 2 * extent + 1 pixels the middle of the shadow is uniform along that axis
+        nRadius = (std::max)(nRadius, 0);
+        int nExtent = nRadius * 3;
+        Key key = { (std::min)(nWidth, nExtent * 2 + 1), (std::min)(nHeight, nExtent * 2 + 1), nRadius, uColor };
+        const Image& shadow = GetShadow(key);
+
+        RECT rcDst = { rcShape.left - nExtent, rcShape.top - nExtent, rcShape.right + nExtent, rcShape.bottom + nExtent };
+        RECT rcInsets = {
+            key.nWidth < nWidth ? nExtent * 2 : shadow.GetWidth() / 2,
+            key.nHeight < nHeight ? nExtent * 2 : shadow.GetHeight() / 2,
+            key.nWidth < nWidth ? nExtent * 2 : shadow.GetWidth() - shadow.GetWidth() / 2,
+            key.nHeight < nHeight ? nExtent * 2 : shadow.GetHeight() - shadow.GetHeight() / 2,
+        };
+        CompositeNineSlice(dst, rcDst, shadow.GetSurface(), rcInsets, mode);
+    }
+
+    /*=========================================================================
+     * NineSliceImage implementation
+     *=========================================================================*/
+    NineSliceImage::NineSliceImage(const Surface& source, const RECT& rcInsets, SIZE_T maxEntries)
+        : m_source(source), m_rcInsets(rcInsets), m_maxEntries(maxEntries)
+    {
+    }
+
+    void NineSliceImage::Draw(const Surface& dst, const RECT& rcDst, BlendMode mode)
+    {
+        int nWidth = rcDst.right - rcDst.left;
+        int nHeight = rcDst.bottom - rcDst.top;
+        if (nWidth <= 0 || nHeight <= 0)
+            return;
+
+        BOOL bStable = nWidth == m_nLastWidth && nHeight == m_nLastHeight;
+        m_nLastWidth = nWidth;
+        m_nLastHeight = nHeight;
+
+        for (auto it = m_entries.begin(); it != m_entries.end(); ++it)
+        {
+            if (it->nWidth == nWidth && it->nHeight == nHeight)
+            {
+                m_entries.splice(m_entries.begin(), m_entries, it);
+                CompositeOver(dst, rcDst.left, rcDst.top, it->image.GetSurface(), mode);
+                return;
+            }
+        }
+
+        if (!bStable || m_maxEntries == 0)
+        {
+            CompositeNineSlice(dst, rcDst, m_source, m_rcInsets, mode);
+            return;
+        }
+
+        // Reuse the least recently used entry storage when the cache is full
+        if (m_entries.size() >= m_maxEntries)
+            m_entries.splice(m_entries.begin(), m_entries, std::prev(m_entries.end()));
+        else
+            m_entries.emplace_front();
+
+        Entry& entry = m_entries.front();
+        entry.nWidth = nWidth;
+        entry.nHeight = nHeight;
+        entry.image.Resize(nWidth, nHeight);
+
+        RECT rcImage = { 0, 0, nWidth, nHeight };
+        CompositeNineSlice(entry.image.GetSurface(), rcImage, m_source, m_rcInsets);
+        CompositeOver(dst, rcDst.left, rcDst.top, entry.image.GetSurface(), mode);
+    }
+
+    /*=========================================================================
+     * Path implementation
+     *=========================================================================*/
+    Path::Path(float fTolerance) : m_fTolerance(fTolerance) {}
+
+    void Path::MoveTo(float x, float y)
+    {
+        m_points.push_back({ x, y });
+        m_contours.push_back({ (UINT32)m_points.size(), FALSE });
+        m_current = { x, y };
+        m_bOpen = TRUE;
+    }
+
+    void Path::LineTo(float x, float y)
+    {
+        if (!m_bOpen)
+            MoveTo(m_current.x, m_current.y);
+
+        m_points.push_back({ x, y });
+        m_contours.back().uEnd = (UINT32)m_points.size();
+        m_current = { x, y };
+    }
+
+    void Path::QuadTo(float cx, float cy, float x, float y)
+    {
+        Point p0 = m_current;
+        float ddx = p0.x - 2 * cx + x;
+        float ddy = p0.y - 2 * cy + y;
+        int nSegments = (int)ceilf(sqrtf(sqrtf(ddx * ddx + ddy * ddy) / (8 * m_fTolerance)));
+        nSegments = (std::min)((std::max)(nSegments, 1), 100);
+
+        for (int i = 1; i <= nSegments; i++)
+        {
+            float t = (float)i / nSegments;
+            float u = 1 - t;
+            LineTo(u * u * p0.x + 2 * u * t * cx + t * t * x, u * u * p0.y + 2 * u * t * cy + t * t * y);
+        }
+    }
+
+    void Path::CubicTo(float cx1, float cy1, float cx2, float cy2, float x, float y)
+    {
+        Point p0 = m_current;
+        float ddx = (std::max)(fabsf(p0.x - 2 * cx1 + cx2), fabsf(cx1 - 2 * cx2 + x));
+        float ddy = (std::max)(fabsf(p0.y - 2 * cy1 + cy2), fabsf(cy1 - 2 * cy2 + y));
+        int nSegments = (int)ceilf(sqrtf(0.75f * sqrtf(ddx * ddx + ddy * ddy) / m_fTolerance));
+        nSegments = (std::min)((std::max)(nSegments, 1), 100);
+
+        for (int i = 1; i <= nSegments; i++)
+        {
+            float t = (float)i / nSegments;
+            float u = 1 - t;
+            float w0 = u * u * u, w1 = 3 * u * u * t, w2 = 3 * u * t * t, w3 = t * t * t;
+            LineTo(w0 * p0.x + w1 * cx1 + w2 * cx2 + w3 * x, w0 * p0.y + w1 * cy1 + w2 * cy2 + w3 * y);
+        }
+    }
+
+    void Path::Close()
+    {
+        if (!m_bOpen)
+            return;
+
+        UINT32 uStart = m_contours.size() > 1 ? m_contours[m_contours.size() - 2].uEnd : 0;
+        m_contours.back().bClosed = TRUE;
+        m_current = m_points[uStart];
+        m_bOpen = FALSE;
+    }
+
+    void Path::AddPolygon(const Point* pPoints, int nCount)
+    {
+        // Every piece gets the same orientation so overlapping pieces never cancel each other
+        float fArea = 0;
+        for (int i = 0; i < nCount; i++)
+        {
+            const Point& a = pPoints[i];
+            const Point& b = pPoints[(i + 1) % nCount];
+            fArea += a.x * b.y - b.x * a.y;
+        }
+
+        MoveTo(pPoints[fArea < 0 ? nCount - 1 : 0].x, pPoints[fArea < 0 ? nCount - 1 : 0].y);
+        for (int i = 1; i < nCount; i++)
+        {
+            const Point& point = pPoints[fArea < 0 ? nCount - 1 - i : i];
+            LineTo(point.x, point.y);
+        }
+        Close();
+    }
+
+    Path Path::Stroke(float fWidth) const
+    {
+        Path result(m_fTolerance);
+        float fHalf = fWidth * 0.5f;
+        if (fHalf <= 0)
+            return result;
+
+        // Round joins and caps are approximated by polygons matching the tolerance
+        int nJoinSides = (int)ceilf(3.14159265f / acosf(1 - (std::min)(m_fTolerance / fHalf, 1.0f)));
+        nJoinSides = (std::min)((std::max)(nJoinSides, 6), 64);
+        std::vector<Point> join(nJoinSides);
+
+        UINT32 uStart = 0;
+        for (const Contour& contour : m_contours)
+        {
+            UINT32 uCount = contour.uEnd - uStart;
+            UINT32 uSegments = contour.bClosed ? uCount : uCount - 1;
+            for (UINT32 i = 0; i < uSegments && uCount > 1; i++)
+            {
+                const Point& a = m_points[uStart + i];
+                const Point& b = m_points[uStart + (i + 1) % uCount];
+                float dx = b.x - a.x;
+                float dy = b.y - a.y;
+                float fLength = sqrtf(dx * dx + dy * dy);
+                if (fLength <= 0)
+                    continue;
+
+                float nx = -dy / fLength * fHalf;
+                float ny = dx / fLength * fHalf;
+                Point quad[4] = { { a.x + nx, a.y + ny }, { b.x + nx, b.y + ny }, { b.x - nx, b.y - ny }, { a.x - nx, a.y - ny } };
+                result.AddPolygon(quad, 4);
+            }
+
+            for (UINT32 i = 0; i < uCount; i++)
+            {
+                const Point& center = m_points[uStart + i];
+                for (int k = 0; k < nJoinSides; k++)
+                {
+                    float fAngle = 6.28318531f * k / nJoinSides;
+                    join[k] = { center.x + cosf(fAngle) * fHalf, center.y + sinf(fAngle) * fHalf };
+                }
+                result.AddPolygon(join.data(), nJoinSides);
+            }
+            uStart = contour.uEnd;
+        }
+
+        return result;
+    }
+
+    /*=========================================================================
+     * Rasterizer implementation
+     *=========================================================================*/
+    void Rasterizer::Reset(int nWidth, int nHeight)
+    {
+        // Two spare cells per row receive the area right of the last pixel
+        m_nWidth = nWidth;
+        m_nHeight = nHeight;
+        m_cells.assign((SIZE_T)(nWidth + 2) * nHeight, 0.0f);
+    }
+
+    void Rasterizer::AddLine(float x0, float y0, float x1, float y1)
+    {
+        if (y0 == y1)
+            return;
+
+        float fDirection = 1.0f;
+        if (y0 > y1)
+        {
+            std::swap(x0, x1);
+            std::swap(y0, y1);
+            fDirection = -1.0f;
+        }
+        if (y1 <= 0 || y0 >= m_nHeight)
+            return;
+
+        // Area left of the surface still counts, so x is clamped rather than clipped
+        float fMaxX = (float)m_nWidth;
+        float dxdy = (x1 - x0) / (y1 - y0);
+        float x = x0;
+        if (y0 < 0)
+        {
+            x -= y0 * dxdy;
+            y0 = 0;
+        }
+
+        int nEndY = (std::min)(m_nHeight, (int)ceilf(y1));
+        for (int y = (int)y0; y < nEndY; y++)
+        {
+            float* pRow = m_cells.data() + (SIZE_T)y * (m_nWidth + 2);
+            float dy = (std::min)((float)(y + 1), y1) - (std::max)((float)y, y0);
+            float xNext = x + dxdy * dy;
+            float d = dy * fDirection;
+
+            float xa = (std::min)((std::max)((std::min)(x, xNext), 0.0f), fMaxX);
+            float xb = (std::min)((std::max)((std::max)(x, xNext), 0.0f), fMaxX);
+            float xaFloor = floorf(xa);
+            int nXa = (int)xaFloor;
+            float xbCeil = ceilf(xb);
+            int nXb = (int)xbCeil;
+
+            if (nXb <= nXa + 1)
+            {
+                // The segment stays within one cell
+                float xMid = 0.5f * (xa + xb) - xaFloor;
+                pRow[nXa] += d - d * xMid;
+                pRow[nXa + 1] += d * xMid;
+            }
+            else
+            {
+                float s = 1.0f / (xb - xa);
+                float xaFraction = xa - xaFloor;
+                float a0 = 0.5f * s * (1 - xaFraction) * (1 - xaFraction);
+                float xbFraction = xb - xbCeil + 1;
+                float am = 0.5f * s * xbFraction * xbFraction;
+
+                pRow[nXa] += d * a0;
+                if (nXb == nXa + 2)
+                {
+                    pRow[nXa + 1] += d * (1 - a0 - am);
+                }
+                else
+                {
+                    float a1 = s * (1.5f - xaFraction);
+                    pRow[nXa + 1] += d * (a1 - a0);
+                    for (int xi = nXa + 2; xi < nXb - 1; xi++)
+                        pRow[xi] += d * s;
+                    float a2 = a1 + (nXb - nXa - 3) * s;
+                    pRow[nXb - 1] += d * (1 - a2 - am);
+                }
+                pRow[nXb] += d * am;
+            }
+            x = xNext;
+        }
+    }
+
+    void Rasterizer::AddPath(const Path& path, float fScaleX, float fScaleY, float fOffsetX, float fOffsetY)
+    {
+        const std::vector<Path::Point>& points = path.GetPoints();
+        UINT32 uStart = 0;
+        for (const Path::Contour& contour : path.GetContours())
+        {
+            for (UINT32 i = uStart; i < contour.uEnd; i++)
+            {
+                const Path::Point& a = points[i];
+                const Path::Point& b = points[i + 1 < contour.uEnd ? i + 1 : uStart];
+                AddLine(a.x * fScaleX + fOffsetX, a.y * fScaleY + fOffsetY, b.x * fScaleX + fOffsetX, b.y * fScaleY + fOffsetY);
+            }
+            uStart = contour.uEnd;
+        }
+    }
+
+    void Rasterizer::Resolve(BYTE* pCoverage, int nStride)
+    {
+        for (int y = 0; y < m_nHeight; y++)
+        {
+            float* pRow = m_cells.data() + (SIZE_T)y * (m_nWidth + 2);
+            BYTE* pOut = pCoverage + (SIZE_T)y * nStride;
+            float fSum = 0;
+            for (int x = 0; x < m_nWidth; x++)
+            {
+                fSum += pRow[x];
+                pOut[x] = (BYTE)((std::min)(fabsf(fSum), 1.0f) * 255.0f + 0.5f);
+            }
+            std::fill(pRow, pRow + m_nWidth + 2, 0.0f);
+        }
+    }
+
+    /*=========================================================================
+     * SvgIcon implementation
+     *=========================================================================*/
+    SvgIcon::Matrix SvgIcon::Matrix::operator*(const Matrix& other) const
+    {
+        return { a * other.a + c * other.b, b * other.a + d * other.b,
+            a * other.c + c * other.d, b * other.c + d * other.d,
+            a * other.e + c * other.f + e, b * other.e + d * other.f + f };
+    }
+
+    // Locale independent number parsing, also splitting "1.5.5" into 1.5 and .5 as SVG requires
+    static BOOL SvgParseNumber(const char*& p, float& fValue)
+    {
+        while (*p == ' ' || *p == ',' || *p == '\t' || *p == '\n' || *p == '\r')
+            p++;
+
+        const char* pStart = p;
+        double dSign = 1;
+        if (*p == '-' || *p == '+')
+            dSign = *p++ == '-' ? -1 : 1;
+
+        double dValue = 0;
+        BOOL bDigits = FALSE;
+        while (*p >= '0' && *p <= '9')
+        {
+            dValue = dValue * 10 + (*p++ - '0');
+            bDigits = TRUE;
+        }
+        if (*p == '.')
+        {
+            p++;
+            double dScale = 0.1;
+            while (*p >= '0' && *p <= '9')
+            {
+                dValue += (*p++ - '0') * dScale;
+                dScale *= 0.1;
+                bDigits = TRUE;
+            }
+        }
+        if (!bDigits)
+        {
+            p = pStart;
+            return FALSE;
+        }
+        if ((*p == 'e' || *p == 'E') && (p[1] == '-' || p[1] == '+' || (p[1] >= '0' && p[1] <= '9')))
+        {
+            p++;
+            int nExponentSign = 1;
+            if (*p == '-' || *p == '+')
+                nExponentSign = *p++ == '-' ? -1 : 1;
+            int nExponent = 0;
+            while (*p >= '0' && *p <= '9')
+                nExponent = nExponent * 10 + (*p++ - '0');
+            dValue *= pow(10.0, nExponentSign * nExponent);
+        }
+
+        fValue = (float)(dSign * dValue);
+        return TRUE;
+    }
+
+    static BOOL SvgParseColor(const std::string& value, UINT32& uColor)
+    {
+        static const std::pair<const char*, UINT32> namedColors[] = {
+            { "black", 0x000000 }, { "white", 0xFFFFFF }, { "red", 0xFF0000 }, { "green", 0x008000 },
+            { "blue", 0x0000FF }, { "yellow", 0xFFFF00 }, { "cyan", 0x00FFFF }, { "magenta", 0xFF00FF },
+            { "gray", 0x808080 }, { "grey", 0x808080 }, { "orange", 0xFFA500 }, { "currentColor", 0x000000 },
+        };
+
+        if (value.size() == 4 && value[0] == '#')
+        {
+            UINT32 uValue = (UINT32)strtoul(value.c_str() + 1, nullptr, 16);
+            uColor = 0xFF000000 | ((uValue & 0xF00) * 0x1100) | ((uValue & 0xF0) * 0x110) | ((uValue & 0xF) * 0x11);
+            return TRUE;
+        }
+        if (value.size() == 7 && value[0] == '#')
+        {
+            uColor = 0xFF000000 | (UINT32)strtoul(value.c_str() + 1, nullptr, 16);
+            return TRUE;
+        }
+        if (value.compare(0, 4, "rgb(") == 0)
+        {
+            const char* p = value.c_str() + 4;
+            float fChannels[3] = {};
+            for (float& fChannel : fChannels)
+            {
+                SvgParseNumber(p, fChannel);
+                if (*p == '%')
+                {
+                    fChannel *= 2.55f;
+                    p++;
+                }
+            }
+            uColor = 0xFF000000;
+            for (int i = 0; i < 3; i++)
+                uColor |= (UINT32)(std::min)((std::max)(fChannels[i], 0.0f), 255.0f) << (16 - 8 * i);
+            return TRUE;
+        }
+        for (const auto& namedColor : namedColors)
+        {
+            if (value == namedColor.first)
+            {
+                uColor = 0xFF000000 | namedColor.second;
+                return TRUE;
+            }
+        }
+        return FALSE;
+    }
+
+    static UINT32 SvgPremultiply(UINT32 uColor, float fOpacity)
+    {
+        UINT32 uAlpha = (UINT32)((uColor >> 24) * (std::min)((std::max)(fOpacity, 0.0f), 1.0f) + 0.5f);
+        UINT32 uResult = uAlpha << 24;
+        for (int nShift = 0; nShift < 24; nShift += 8)
+            uResult |= ((((uColor >> nShift) & 0xFF) * uAlpha + 127) / 255) << nShift;
+        return uResult;
+    }
+
+    void SvgIcon::ParseAttribute(Style& style, const std::string& name, const std::string& value)
+    {
+        const char* p = value.c_str();
+        float fValue = 0;
+
+        if (name == "fill" || name == "stroke")
+        {
+            BOOL& bEnabled = name == "fill" ? style.bFill : style.bStroke;
+            UINT32& uColor = name == "fill" ? style.uFill : style.uStroke;
+            bEnabled = SvgParseColor(value, uColor);
+        }
+        else if (name == "stroke-width" && SvgParseNumber(p, fValue))
+            style.fStrokeWidth = fValue;
+        else if (name == "opacity" && SvgParseNumber(p, fValue))
+            style.fOpacity *= fValue;
+        else if (name == "fill-opacity" && SvgParseNumber(p, fValue))
+            style.fFillOpacity = fValue;
+        else if (name == "stroke-opacity" && SvgParseNumber(p, fValue))
+            style.fStrokeOpacity = fValue;
+        else if (name == "style")
+        {
+            // Declarations of the style attribute are handled like presentation attributes
+            SIZE_T start = 0;
+            while (start < value.size())
+            {
+                SIZE_T end = value.find(';', start);
+                if (end == std::string::npos)
+                    end = value.size();
+                SIZE_T colon = value.find(':', start);
+                if (colon < end)
+                {
+                    auto Trim = [](std::string text)
+                    {
+                        SIZE_T first = text.find_first_not_of(" \t\r\n");
+                        SIZE_T last = text.find_last_not_of(" \t\r\n");
+                        return first == std::string::npos ? std::string() : text.substr(first, last - first + 1);
+                    };
+                    ParseAttribute(style, Trim(value.substr(start, colon - start)), Trim(value.substr(colon + 1, end - colon - 1)));
+                }
+                start = end + 1;
+            }
+        }
+        else if (name == "transform")
+        {
+            while (*p)
+            {
+                while (*p == ' ' || *p == ',' || *p == '\t' || *p == '\n' || *p == '\r')
+                    p++;
+                const char* pName = p;
+                while (*p && *p != '(')
+                    p++;
+                if (*p != '(')
+                    break;
+                std::string function(pName, p - pName);
+                function.erase(function.find_last_not_of(" \t\r\n") + 1);
+                p++;
+
+                float fArgs[6] = {};
+                int nArgs = 0;
+                while (nArgs < 6 && SvgParseNumber(p, fArgs[nArgs]))
+                    nArgs++;
+                while (*p && *p != ')')
+                    p++;
+                if (*p == ')')
+                    p++;
+
+                Matrix matrix{};
+                if (function == "matrix" && nArgs == 6)
+                    matrix = { fArgs[0], fArgs[1], fArgs[2], fArgs[3], fArgs[4], fArgs[5] };
+                else if (function == "translate")
+                    matrix.e = fArgs[0], matrix.f = nArgs > 1 ? fArgs[1] : 0;
+                else if (function == "scale")
+                    matrix.a = fArgs[0], matrix.d = nArgs > 1 ? fArgs[1] : fArgs[0];
+                else if (function == "rotate")
+                {
+                    float fRadians = fArgs[0] * 3.14159265f / 180.0f;
+                    Matrix rotation = { cosf(fRadians), sinf(fRadians), -sinf(fRadians), cosf(fRadians), 0, 0 };
+                    Matrix to = { 1, 0, 0, 1, fArgs[1], fArgs[2] };
+                    Matrix back = { 1, 0, 0, 1, -fArgs[1], -fArgs[2] };
+                    matrix = nArgs == 3 ? to * rotation * back : rotation;
+                }
+                else if (function == "skewX")
+                    matrix.c = tanf(fArgs[0] * 3.14159265f / 180.0f);
+                else if (function == "skewY")
+                    matrix.b = tanf(fArgs[0] * 3.14159265f / 180.0f);
+                style.transform = style.transform * matrix;
+            }
+        }
+    }
+
+    void SvgIcon::ParsePathData(Path& path, const Matrix& transform, const std::string& data)
+    {
+        // Points are tracked in user space and transformed when added to the path
+        const char* p = data.c_str();
+        char command = 0;
+        char previous = 0;
+        float x = 0, y = 0, startX = 0, startY = 0, controlX = 0, controlY = 0;
+        auto Move = [&](float px, float py) { Path::Point point = transform.Apply(px, py); path.MoveTo(point.x, point.y); };
+        auto Line = [&](float px, float py) { Path::Point point = transform.Apply(px, py); path.LineTo(point.x, point.y); };
+        auto Cubic = [&](float x1, float y1, float x2, float y2, float px, float py)
+        {
+            Path::Point p1 = transform.Apply(x1, y1), p2 = transform.Apply(x2, y2), p3 = transform.Apply(px, py);
+            path.CubicTo(p1.x, p1.y, p2.x, p2.y, p3.x, p3.y);
+        };
+        auto Quad = [&](float x1, float y1, float px, float py)
+        {
+            Path::Point p1 = transform.Apply(x1, y1), p2 = transform.Apply(px, py);
+            path.QuadTo(p1.x, p1.y, p2.x, p2.y);
+        };
+
+        for (;;)
+        {
+            while (*p == ' ' || *p == ',' || *p == '\t' || *p == '\n' || *p == '\r')
+                p++;
+            if (*p == 0)
+                break;
+            if (isalpha((unsigned char)*p))
+                command = *p++;
+            else if (command == 0)
+                break;
+
+            BOOL bRelative = islower((unsigned char)command);
+            float fOriginX = bRelative ? x : 0;
+            float fOriginY = bRelative ? y : 0;
+            float v[7] = {};
+            auto Read = [&](int nCount)
+            {
+                for (int i = 0; i < nCount; i++)
+                    if (!SvgParseNumber(p, v[i]))
+                        return FALSE;
+                return TRUE;
+            };
+
+            // S and T only reflect the control point of a curve of their own kind
+            char upper = (char)toupper((unsigned char)command);
+            BOOL bCubicBefore = previous == 'C' || previous == 'S';
+            BOOL bQuadBefore = previous == 'Q' || previous == 'T';
+            previous = upper;
+            if (upper == 'Z')
+            {
+                path.Close();
+                x = startX;
+                y = startY;
+                controlX = x;
+                controlY = y;
+                continue;
+            }
+            else if (upper == 'M' && Read(2))
+            {
+                x = fOriginX + v[0];
+                y = fOriginY + v[1];
+                startX = x;
+                startY = y;
+                Move(x, y);
+                // Extra coordinate pairs after a move are implicit lines
+                command = bRelative ? 'l' : 'L';
+            }
+            else if (upper == 'L' && Read(2))
+            {
+                x = fOriginX + v[0];
+                y = fOriginY + v[1];
+                Line(x, y);
+            }
+            else if (upper == 'H' && Read(1))
+            {
+                x = fOriginX + v[0];
+                Line(x, y);
+            }
+            else if (upper == 'V' && Read(1))
+            {
+                y = fOriginY + v[0];
+                Line(x, y);
+            }
+            else if (upper == 'C' && Read(6))
+            {
+                controlX = fOriginX + v[2];
+                controlY = fOriginY + v[3];
+                Cubic(fOriginX + v[0], fOriginY + v[1], controlX, controlY, fOriginX + v[4], fOriginY + v[5]);
+                x = fOriginX + v[4];
+                y = fOriginY + v[5];
+                continue;
+            }
+            else if (upper == 'S' && Read(4))
+            {
+                float x1 = bCubicBefore ? 2 * x - controlX : x;
+                float y1 = bCubicBefore ? 2 * y - controlY : y;
+                controlX = fOriginX + v[0];
+                controlY = fOriginY + v[1];
+                Cubic(x1, y1, controlX, controlY, fOriginX + v[2], fOriginY + v[3]);
+                x = fOriginX + v[2];
+                y = fOriginY + v[3];
+                continue;
+            }
+            else if (upper == 'Q' && Read(4))
+            {
+                controlX = fOriginX + v[0];
+                controlY = fOriginY + v[1];
+                Quad(controlX, controlY, fOriginX + v[2], fOriginY + v[3]);
+                x = fOriginX + v[2];
+                y = fOriginY + v[3];
+                continue;
+            }
+            else if (upper == 'T' && Read(2))
+            {
+                controlX = bQuadBefore ? 2 * x - controlX : x;
+                controlY = bQuadBefore ? 2 * y - controlY : y;
+                Quad(controlX, controlY, fOriginX + v[0], fOriginY + v[1]);
+                x = fOriginX + v[0];
+                y = fOriginY + v[1];
+                continue;
+            }
+            else if (upper == 'A' && Read(3))
+            {
+                // Flags may be written without separators ("a1 1 0 011 1")
+                float fFlags[2] = {};
+                for (float& fFlag : fFlags)
+                {
+                    while (*p == ' ' || *p == ',' || *p == '\t' || *p == '\n' || *p == '\r')
+                        p++;
+                    fFlag = (float)(*p == '1');
+                    if (*p == '0' || *p == '1')
+                        p++;
+                }
+                float fEndX = 0, fEndY = 0;
+                if (!SvgParseNumber(p, fEndX) || !SvgParseNumber(p, fEndY))
+                    break;
+
+                float fRadiusX = fabsf(v[0]);
+                float fRadiusY = fabsf(v[1]);
+                float fCos = cosf(v[2] * 3.14159265f / 180.0f);
+                float fSin = sinf(v[2] * 3.14159265f / 180.0f);
+                float x2 = fOriginX + fEndX;
+                float y2 = fOriginY + fEndY;
+
+                if (fRadiusX == 0 || fRadiusY == 0)
+                {
+                    Line(x2, y2);
+                }
+                else if (x2 != x || y2 != y)
+                {
+                    // Endpoint to center parameterization (SVG implementation notes F.6.5)
+                    float dx = (x - x2) * 0.5f;
+                    float dy = (y - y2) * 0.5f;
+                    float x1p = fCos * dx + fSin * dy;
+                    float y1p = -fSin * dx + fCos * dy;
+                    float fLambda = (x1p * x1p) / (fRadiusX * fRadiusX) + (y1p * y1p) / (fRadiusY * fRadiusY);
+                    if (fLambda > 1)
+                    {
+                        fRadiusX *= sqrtf(fLambda);
+                        fRadiusY *= sqrtf(fLambda);
+                    }
+
+                    float rx2 = fRadiusX * fRadiusX;
+                    float ry2 = fRadiusY * fRadiusY;
+                    float fDenominator = rx2 * y1p * y1p + ry2 * x1p * x1p;
+                    float fCoefficient = sqrtf((std::max)(0.0f, (rx2 * ry2 - fDenominator) / fDenominator));
+                    if (fFlags[0] == fFlags[1])
+                        fCoefficient = -fCoefficient;
+                    float cxp = fCoefficient * fRadiusX * y1p / fRadiusY;
+                    float cyp = -fCoefficient * fRadiusY * x1p / fRadiusX;
+                    float cx = fCos * cxp - fSin * cyp + (x + x2) * 0.5f;
+                    float cy = fSin * cxp + fCos * cyp + (y + y2) * 0.5f;
+
+                    float ux = (x1p - cxp) / fRadiusX, uy = (y1p - cyp) / fRadiusY;
+                    float vx = (-x1p - cxp) / fRadiusX, vy = (-y1p - cyp) / fRadiusY;
+                    float fTheta = atan2f(uy, ux);
+                    float fDelta = atan2f(ux * vy - uy * vx, ux * vx + uy * vy);
+                    if (fFlags[1] == 0 && fDelta > 0)
+                        fDelta -= 6.28318531f;
+                    else if (fFlags[1] != 0 && fDelta < 0)
+                        fDelta += 6.28318531f;
+
+                    // One cubic per quarter turn at most
+                    int nSegments = (std::max)(1, (int)ceilf(fabsf(fDelta) / 1.57079633f - 0.001f));
+                    float fStep = fDelta / nSegments;
+                    float k = 4.0f / 3.0f * tanf(fStep / 4);
+                    auto ArcPoint = [&](float t, float& px, float& py, float& tx, float& ty)
+                    {
+                        float c = cosf(t), s = sinf(t);
+                        px = cx + fRadiusX * c * fCos - fRadiusY * s * fSin;
+                        py = cy + fRadiusX * c * fSin + fRadiusY * s * fCos;
+                        tx = -fRadiusX * s * fCos - fRadiusY * c * fSin;
+                        ty = -fRadiusX * s * fSin + fRadiusY * c * fCos;
+                    };
+                    for (int i = 0; i < nSegments; i++)
+                    {
+                        float px1, py1, tx1, ty1, px2, py2, tx2, ty2;
+                        ArcPoint(fTheta + fStep * i, px1, py1, tx1, ty1);
+                        ArcPoint(fTheta + fStep * (i + 1), px2, py2, tx2, ty2);
+                        if (i == nSegments - 1)
+                            px2 = x2, py2 = y2;
+                        Cubic(px1 + k * tx1, py1 + k * ty1, px2 - k * tx2, py2 - k * ty2, px2, py2);
+                    }
+                }
+                x = x2;
+                y = y2;
+            }
+            else
+            {
+                break;
+            }
+            controlX = x;
+            controlY = y;
+        }
+    }
+
+    void SvgIcon::AddShape(const Style& style, const std::string& element, const std::map<std::string, std::string>& attributes)
+    {
+        auto Number = [&](const char* pName, float fDefault)
+        {
+            auto it = attributes.find(pName);
+            float fValue = fDefault;
+            const char* p = it != attributes.end() ? it->second.c_str() : "";
+            return SvgParseNumber(p, fValue) ? fValue : fDefault;
+        };
+
+        const Matrix& transform = style.transform;
+        Path path(m_fTolerance);
+        auto Move = [&](float x, float y) { Path::Point point = transform.Apply(x, y); path.MoveTo(point.x, point.y); };
+        auto Line = [&](float x, float y) { Path::Point point = transform.Apply(x, y); path.LineTo(point.x, point.y); };
+        auto Cubic = [&](float x1, float y1, float x2, float y2, float x, float y)
+        {
+            Path::Point p1 = transform.Apply(x1, y1), p2 = transform.Apply(x2, y2), p3 = transform.Apply(x, y);
+            path.CubicTo(p1.x, p1.y, p2.x, p2.y, p3.x, p3.y);
+        };
+
+        // Quarter ellipse arcs use the usual 0.5523 control point distance
+        const float k = 0.55228475f;
+        BOOL bFillable = TRUE;
+        if (element == "path")
+        {
+            auto it = attributes.find("d");
+            if (it != attributes.end())
+                ParsePathData(path, transform, it->second);
+        }
+        else if (element == "rect")
+        {
+            float x = Number("x", 0), y = Number("y", 0), w = Number("width", 0), h = Number("height", 0);
+            float rx = Number("rx", -1), ry = Number("ry", -1);
+            if (rx < 0)
+                rx = ry < 0 ? 0 : ry;
+            if (ry < 0)
+                ry = rx;
+            rx = (std::min)(rx, w * 0.5f);
+            ry = (std::min)(ry, h * 0.5f);
+            if (w <= 0 || h <= 0)
+                return;
+
+            Move(x + rx, y);
+            Line(x + w - rx, y);
+            if (rx > 0)
+                Cubic(x + w - rx + rx * k, y, x + w, y + ry - ry * k, x + w, y + ry);
+            Line(x + w, y + h - ry);
+            if (rx > 0)
+                Cubic(x + w, y + h - ry + ry * k, x + w - rx + rx * k, y + h, x + w - rx, y + h);
+            Line(x + rx, y + h);
+            if (rx > 0)
+                Cubic(x + rx - rx * k, y + h, x, y + h - ry + ry * k, x, y + h - ry);
+            Line(x, y + ry);
+            if (rx > 0)
+                Cubic(x, y + ry - ry * k, x + rx - rx * k, y, x + rx, y);
+            path.Close();
+        }
+        else if (element == "circle" || element == "ellipse")
+        {
+            float cx = Number("cx", 0), cy = Number("cy", 0);
+            float rx = element == "circle" ? Number("r", 0) : Number("rx", 0);
+            float ry = element == "circle" ? rx : Number("ry", 0);
+            if (rx <= 0 || ry <= 0)
+                return;
+
+            Move(cx + rx, cy);
+            Cubic(cx + rx, cy + ry * k, cx + rx * k, cy + ry, cx, cy + ry);
+            Cubic(cx - rx * k, cy + ry, cx - rx, cy + ry * k, cx - rx, cy);
+            Cubic(cx - rx, cy - ry * k, cx - rx * k, cy - ry, cx, cy - ry);
+            Cubic(cx + rx * k, cy - ry, cx + rx, cy - ry * k, cx + rx, cy);
+            path.Close();
+        }
+        else if (element == "line")
+        {
+            Move(Number("x1", 0), Number("y1", 0));
+            Line(Number("x2", 0), Number("y2", 0));
+            bFillable = FALSE;
+        }
+        else if (element == "polyline" || element == "polygon")
+        {
+            auto it = attributes.find("points");
+            const char* p = it != attributes.end() ? it->second.c_str() : "";
+            float x = 0, y = 0;
+            for (int i = 0; SvgParseNumber(p, x) && SvgParseNumber(p, y); i++)
+            {
+                if (i == 0)
+                    Move(x, y);
+                else
+                    Line(x, y);
+            }
+            if (element == "polygon")
+                path.Close();
+        }
+
+        if (path.IsEmpty())
+            return;
+
+        Shape shape = { Path(m_fTolerance), Path(m_fTolerance), 0, 0 };
+        if (style.bStroke && style.fStrokeWidth > 0)
+        {
+            float fScale = sqrtf(fabsf(transform.a * transform.d - transform.b * transform.c));
+            shape.stroke = path.Stroke(style.fStrokeWidth * fScale);
+            shape.uStroke = SvgPremultiply(style.uStroke, style.fOpacity * style.fStrokeOpacity);
+        }
+        if (style.bFill && bFillable)
+        {
+            shape.fill = std::move(path);
+            shape.uFill = SvgPremultiply(style.uFill, style.fOpacity * style.fFillOpacity);
+        }
+        m_shapes.push_back(std::move(shape));
+    }
+
+    void SvgIcon::Parse(const char* pSource, SIZE_T size)
+    {
+        std::string source(pSource, size);
+        std::vector<Style> styles(1);
+        int nSkipDepth = 0;
+        BOOL bRoot = TRUE;
+
+        SIZE_T position = 0;
+        while ((position = source.find('<', position)) != std::string::npos)
+        {
+            if (source.compare(position, 4, "<!--") == 0)
+            {
+                position = source.find("-->", position);
+                continue;
+            }
+            if (source.compare(position, 2, "<?") == 0 || source.compare(position, 2, "<!") == 0)
+            {
+                position = source.find('>', position);
+                continue;
+            }
+            if (source.compare(position, 2, "</") == 0)
+            {
+                if (nSkipDepth > 0)
+                    nSkipDepth--;
+                else if (styles.size() > 1)
+                    styles.pop_back();
+                position = source.find('>', position);
+                continue;
+            }
+
+            // Element name and attributes
+            SIZE_T nameEnd = source.find_first_of(" \t\r\n/>", position + 1);
+            if (nameEnd == std::string::npos)
+                break;
+            std::string element = source.substr(position + 1, nameEnd - position - 1);
+            std::map<std::string, std::string> attributes;
+            position = nameEnd;
+            BOOL bSelfClosing = FALSE;
+            while (position < source.size() && source[position] != '>')
+            {
+                if (source[position] == '/')
+                {
+                    bSelfClosing = TRUE;
+                    position++;
+                    continue;
+                }
+                if (isspace((unsigned char)source[position]))
+                {
+                    position++;
+                    continue;
+                }
+
+                SIZE_T equal = source.find('=', position);
+                if (equal == std::string::npos)
+                    break;
+                std::string name = source.substr(position, equal - position);
+                name.erase(name.find_last_not_of(" \t\r\n") + 1);
+                SIZE_T quote = source.find_first_of("\"'", equal);
+                if (quote == std::string::npos)
+                    break;
+                SIZE_T quoteEnd = source.find(source[quote], quote + 1);
+                if (quoteEnd == std::string::npos)
+                    break;
+                attributes[name] = source.substr(quote + 1, quoteEnd - quote - 1);
+                position = quoteEnd + 1;
+            }
+
+            if (nSkipDepth > 0)
+            {
+                if (!bSelfClosing)
+                    nSkipDepth++;
+                continue;
+            }
+
+            BOOL bGroup = element == "svg" || element == "g" || element == "a";
+            BOOL bShape = element == "path" || element == "rect" || element == "circle" || element == "ellipse"
+                || element == "line" || element == "polyline" || element == "polygon";
+            if (!bGroup && !bShape)
+            {
+                // Definitions, metadata and unsupported elements are skipped with their content
+                if (!bSelfClosing)
+                    nSkipDepth = 1;
+                continue;
+            }
+
+            if (element == "svg" && bRoot)
+            {
+                auto viewBox = attributes.find("viewBox");
+                const char* p = viewBox != attributes.end() ? viewBox->second.c_str() : "";
+                float fWidth = 0, fHeight = 0;
+                if (!(SvgParseNumber(p, m_fViewX) && SvgParseNumber(p, m_fViewY)
+                    && SvgParseNumber(p, m_fViewWidth) && SvgParseNumber(p, m_fViewHeight)))
+                {
+                    const char* pWidth = attributes.count("width") ? attributes["width"].c_str() : "";
+                    const char* pHeight = attributes.count("height") ? attributes["height"].c_str() : "";
+                    SvgParseNumber(pWidth, fWidth);
+                    SvgParseNumber(pHeight, fHeight);
+                    m_fViewX = 0;
+                    m_fViewY = 0;
+                    m_fViewWidth = fWidth;
+                    m_fViewHeight = fHeight;
+                }
+                if (m_fViewWidth <= 0 || m_fViewHeight <= 0)
+                    throw ApplicationException(L"The SVG icon has neither a viewBox nor a size");
+
+                // Fine enough for renderings up to about 1024 pixels
+                m_fTolerance = (std::max)(m_fViewWidth, m_fViewHeight) / 2048.0f;
+                bRoot = FALSE;
+            }
+
+            Style style = styles.back();
+            for (const auto& attribute : attributes)
+                ParseAttribute(style, attribute.first, attribute.second);
+
+            if (bShape)
+                AddShape(style, element, attributes);
+            if (!bSelfClosing)
+                styles.push_back(style);
+        }
+
+        if (bRoot)
+            throw ApplicationException(L"The SVG icon has no svg element");
+    }
+
+    static UINT64 SvgNextIconId()
+    {
+        static std::atomic<UINT64> s_ulNextId{ 1 };
+        return s_ulNextId.fetch_add(1);
+    }
+
+    SvgIcon::SvgIcon(const char* pSource, SIZE_T size) : m_ulId(SvgNextIconId()) { Parse(pSource, size); }
+
+    SvgIcon::SvgIcon(LPCWSTR lpFileName) : m_ulId(SvgNextIconId())
+    {
+        HANDLE hFile = CreateFileW(lpFileName, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+            FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+        if (hFile == INVALID_HANDLE_VALUE)
+            throw ApplicationException(L"Failed to open the SVG icon (CreateFileW)");
+
+        LARGE_INTEGER liSize = {};
+        std::string source;
+        DWORD dwRead = 0;
+        BOOL bRead = GetFileSizeEx(hFile, &liSize);
+        if (bRead)
+        {
+            source.resize((SIZE_T)liSize.QuadPart);
+            bRead = ReadFile(hFile, &source[0], (DWORD)source.size(), &dwRead, NULL);
+        }
+        CloseHandle(hFile);
+        if (!bRead)
+            throw ApplicationException(L"Failed to read the SVG icon (ReadFile)");
+
+        Parse(source.data(), dwRead);
+    }
+
+    void SvgIcon::Render(Image& image, Rasterizer& rasterizer) const
+    {
+        const Surface& surface = image.GetSurface();
+        image.Clear();
+        if (surface.nWidth <= 0 || surface.nHeight <= 0)
+            return;
+
+        float fScale = (std::min)(surface.nWidth / m_fViewWidth, surface.nHeight / m_fViewHeight);
+        float fOffsetX = (surface.nWidth - m_fViewWidth * fScale) * 0.5f - m_fViewX * fScale;
+        float fOffsetY = (surface.nHeight - m_fViewHeight * fScale) * 0.5f - m_fViewY * fScale;
+
+        std::vector<BYTE> coverage((SIZE_T)surface.nWidth * surface.nHeight);
+        rasterizer.Reset(surface.nWidth, surface.nHeight);
+        for (const Shape& shape : m_shapes)
+        {
+            const std::pair<const Path*, UINT32> layers[2] = { { &shape.fill, shape.uFill }, { &shape.stroke, shape.uStroke } };
+            for (const auto& layer : layers)
+            {
+                if (layer.first->IsEmpty() || layer.second == 0)
+                    continue;
+
+                rasterizer.AddPath(*layer.first, fScale, fScale, fOffsetX, fOffsetY);
+                rasterizer.Resolve(coverage.data(), surface.nWidth);
+                FillMask(surface, 0, 0, coverage.data(), surface.nWidth, surface.nHeight, surface.nWidth, layer.second);
+            }
+        }
+    }
+
+    /*=========================================================================
+     * ShelfPacker implementation
+     *=========================================================================*/
+    BOOL ShelfPacker::Allocate(int nWidth, int nHeight, RECT& rcEntry)
+    {
+        // Best fitting shelf first, a new shelf below the last one otherwise
+        Shelf* pBest = nullptr;
+        for (Shelf& shelf : m_shelves)
+        {
+            if (shelf.nHeight >= nHeight && shelf.nCursor + nWidth <= m_nWidth
+                && (pBest == nullptr || shelf.nHeight < pBest->nHeight))
+                pBest = &shelf;
+        }
+        if (pBest == nullptr)
+        {
+            int nTop = m_shelves.empty() ? 0 : m_shelves.back().nTop + m_shelves.back().nHeight;
+            if (nTop + nHeight > m_nHeight || nWidth > m_nWidth)
+                return FALSE;
+            m_shelves.push_back({ nTop, nHeight, 0 });
+            pBest = &m_shelves.back();
+        }
+
+        rcEntry = { pBest->nCursor, pBest->nTop, pBest->nCursor + nWidth, pBest->nTop + nHeight };
+        pBest->nCursor += nWidth;
+        return TRUE;
+    }
+
+    /*=========================================================================
+     * IconAtlas implementation
+     *=========================================================================*/
+    IconAtlas::IconAtlas(int nWidth, int nHeight) : m_atlas(nWidth, nHeight), m_packer(nWidth, nHeight) {}
+
+    void IconAtlas::Clear()
+    {
+        m_entries.clear();
+        m_packer.Clear();
+    }
+
+    void IconAtlas::Draw(const Surface& dst, int x, int y, const SvgIcon& icon, int nSize, UINT uDpi, BlendMode mode)
+    {
+        int nPixels = (int)((nSize * uDpi + 48) / 96);
+        if (nPixels <= 0)
+            return;
+
+        RECT rcDst = { x, y, x + nPixels, y + nPixels };
+        Key key = { icon.GetId(), nPixels };
+        auto it = m_entries.find(key);
+        if (it != m_entries.end())
+        {
+            CompositeScaled(dst, rcDst, m_atlas.GetSurface(), it->second, mode);
+            return;
+        }
+
+        m_scratch.Resize(nPixels, nPixels);
+        icon.Render(m_scratch, m_rasterizer);
+
+        RECT rcEntry = {};
+        if (!m_packer.Allocate(nPixels, nPixels, rcEntry))
+        {
+            Clear();
+            if (!m_packer.Allocate(nPixels, nPixels, rcEntry))
+            {
+                // Larger than the atlas itself
+                CompositeOver(dst, x, y, m_scratch.GetSurface(), mode);
+                return;
+            }
+        }
+
+        const Surface& atlas = m_atlas.GetSurface();
+        for (int nRow = 0; nRow < nPixels; nRow++)
+            memcpy(atlas.GetRow(rcEntry.top + nRow) + rcEntry.left, m_scratch.GetSurface().GetRow(nRow), nPixels * sizeof(UINT32));
+        m_entries[key] = rcEntry;
+
+        CompositeScaled(dst, rcDst, atlas, rcEntry, mode);
+    }
+
+    /*=========================================================================
+     * Font implementation
+     *=========================================================================*/
+    static UINT32 FontReadU16(const BYTE* p)
+    {
+        return ((UINT32)p[0] << 8) | p[1];
+    }
+
+    static UINT32 FontReadU32(const BYTE* p)
+    {
+        return ((UINT32)p[0] << 24) | ((UINT32)p[1] << 16) | ((UINT32)p[2] << 8) | p[3];
+    }
+
+    static float FontReadF2Dot14(const BYTE* p)
+    {
+        return (INT16)FontReadU16(p) / 16384.0f;
+    }
+
+    // Decodes the UTF-16 code point at i (surrogate pairs included) and moves past it
+    static UINT32 FontNextCodepoint(const wchar_t* pText, SIZE_T length, SIZE_T& i)
+    {
+        UINT32 uCodepoint = pText[i++];
+        if (uCodepoint >= 0xD800 && uCodepoint < 0xDC00 && i < length && pText[i] >= 0xDC00 && pText[i] < 0xE000)
+            uCodepoint = 0x10000 + ((uCodepoint - 0xD800) << 10) + (pText[i++] - 0xDC00);
+        return uCodepoint;
+    }
+
+    Font::Font(LPCWSTR lpFileName)
+    {
+        m_hFile = CreateFileW(lpFileName, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+        if (m_hFile == INVALID_HANDLE_VALUE)
+            throw ApplicationException(L"Failed to open the font (CreateFileW)");
+
+        LARGE_INTEGER liSize = {};
+        if (!GetFileSizeEx(m_hFile, &liSize) || liSize.QuadPart < 12)
+        {
+            CloseHandle(m_hFile);
+            throw ApplicationException(L"Failed to get the font size (GetFileSizeEx)");
+        }
+        m_size = (SIZE_T)liSize.QuadPart;
+
+        m_hMapping = CreateFileMappingW(m_hFile, NULL, PAGE_READONLY, 0, 0, NULL);
+        if (m_hMapping == NULL)
+        {
+            CloseHandle(m_hFile);
+            throw ApplicationException(L"Failed to map the font (CreateFileMappingW)");
+        }
+
+        m_pData = (const BYTE*)MapViewOfFile(m_hMapping, FILE_MAP_READ, 0, 0, 0);
+        if (m_pData == nullptr)
+        {
+            CloseHandle(m_hMapping);
+            CloseHandle(m_hFile);
+            throw ApplicationException(L"Failed to map the font (MapViewOfFile)");
+        }
+
+        if (!ParseHeader())
+        {
+            UnmapViewOfFile(m_pData);
+            CloseHandle(m_hMapping);
+            CloseHandle(m_hFile);
+            throw ApplicationException(L"Failed to parse the font (unsupported or corrupted TrueType file)");
+        }
+    }
+
+    Font::~Font()
+    {
+        UnmapViewOfFile(m_pData);
+        CloseHandle(m_hMapping);
+        CloseHandle(m_hFile);
+    }
+
+    const BYTE* Font::FindTable(UINT32 uTag, UINT32* puLength) const
+    {
+        UINT32 uCount = FontReadU16(m_pData + 4);
+        if (12 + (SIZE_T)uCount * 16 > m_size)
+            return nullptr;
+
+        for (UINT32 i = 0; i < uCount; i++)
+        {
+            const BYTE* pRecord = m_pData + 12 + i * 16;
+            if (FontReadU32(pRecord) != uTag)
+                continue;
+
+            UINT32 uOffset = FontReadU32(pRecord + 8);
+            UINT32 uLength = FontReadU32(pRecord + 12);
+            if ((UINT64)uOffset + uLength > m_size)
+                return nullptr;
+            *puLength = uLength;
+            return m_pData + uOffset;
+        }
+        return nullptr;
+    }
+
+    BOOL Font::ParseHeader()
+    {
+        // TrueType outlines only, 'true' being the legacy Apple signature
+        UINT32 uVersion = FontReadU32(m_pData);
+        if (uVersion != 0x00010000 && uVersion != 0x74727565)
+            return FALSE;
+
+        UINT32 uHeadLength = 0, uMaxpLength = 0, uHheaLength = 0;
+        const BYTE* pHead = FindTable(0x68656164, &uHeadLength); // 'head'
+        const BYTE* pMaxp = FindTable(0x6D617870, &uMaxpLength); // 'maxp'
+        const BYTE* pHhea = FindTable(0x68686561, &uHheaLength); // 'hhea'
+        if (pHead == nullptr || uHeadLength < 54 || pMaxp == nullptr || uMaxpLength < 6 || pHhea == nullptr || uHheaLength < 36)
+            return FALSE;
+
+        m_nUnitsPerEm = (int)FontReadU16(pHead + 18);
+        m_bLongOffsets = FontReadU16(pHead + 50) != 0;
+        m_uGlyphCount = FontReadU16(pMaxp + 4);
+        m_nAscender = (INT16)FontReadU16(pHhea + 4);
+        m_nDescender = (INT16)FontReadU16(pHhea + 6);
+        m_nLineGap = (INT16)FontReadU16(pHhea + 8);
+        m_uMetricCount = FontReadU16(pHhea + 34);
+        return m_nUnitsPerEm > 0;
+    }
+
+    void Font::ResolveCmap()
+    {
+        m_bCmapResolved = TRUE;
+
+        UINT32 uLength = 0;
+        const BYTE* pCmap = FindTable(0x636D6170, &uLength); // 'cmap'
+        if (pCmap == nullptr || uLength < 4)
+            return;
+
+        // Full Unicode (format 12) preferred over the BMP (format 4)
+        UINT32 uCount = (std::min)(FontReadU16(pCmap + 2), (uLength - 4) / 8);
+        int nBest = 0;
+        for (UINT32 i = 0; i < uCount; i++)
+        {
+            const BYTE* pRecord = pCmap + 4 + i * 8;
+            UINT32 uPlatform = FontReadU16(pRecord);
+            UINT32 uEncoding = FontReadU16(pRecord + 2);
+            UINT32 uOffset = FontReadU32(pRecord + 4);
+            if (uPlatform != 0 && !(uPlatform == 3 && (uEncoding == 1 || uEncoding == 10)))
+                continue;
+            if ((UINT64)uOffset + 16 > uLength)
+                continue;
+
+            const BYTE* pSubtable = pCmap + uOffset;
+            UINT32 uFormat = FontReadU16(pSubtable);
+            UINT32 uSubtableLength = uFormat == 12 ? FontReadU32(pSubtable + 4) : FontReadU16(pSubtable + 2);
+            int nScore = uFormat == 12 ? 2 : uFormat == 4 ? 1 : 0;
+            if (nScore > nBest && (UINT64)uOffset + uSubtableLength <= uLength)
+            {
+                nBest = nScore;
+                m_pCmap = pSubtable;
+                m_uCmapLength = uSubtableLength;
+            }
+        }
+    }
+
+    UINT32 Font::GetGlyphIndex(UINT32 uCodepoint)
+    {
+        if (!m_bCmapResolved)
+            ResolveCmap();
+        if (m_pCmap == nullptr)
+            return 0;
+
+        if (FontReadU16(m_pCmap) == 12)
+        {
+            UINT32 uGroups = (std::min)(FontReadU32(m_pCmap + 12), (m_uCmapLength - 16) / 12);
+            UINT32 uLow = 0, uHigh = uGroups;
+            while (uLow < uHigh)
+            {
+                UINT32 uMiddle = (uLow + uHigh) / 2;
+                const BYTE* pGroup = m_pCmap + 16 + uMiddle * 12;
+                if (uCodepoint < FontReadU32(pGroup))
+                    uHigh = uMiddle;
+                else if (uCodepoint > FontReadU32(pGroup + 4))
+                    uLow = uMiddle + 1;
+                else
+                    return FontReadU32(pGroup + 8) + (uCodepoint - FontReadU32(pGroup));
+            }
+            return 0;
+        }
+
+        // Format 4: segments sorted by end code, parallel arrays of end, start, delta and range offset
+        if (uCodepoint > 0xFFFF)
+            return 0;
+        UINT32 uSegmentsX2 = FontReadU16(m_pCmap + 6);
+        if (16 + (SIZE_T)uSegmentsX2 * 4 > m_uCmapLength)
+            return 0;
+
+        const BYTE* pEnds = m_pCmap + 14;
+        const BYTE* pStarts = pEnds + uSegmentsX2 + 2;
+        const BYTE* pDeltas = pStarts + uSegmentsX2;
+        const BYTE* pRanges = pDeltas + uSegmentsX2;
+        UINT32 uLow = 0, uHigh = uSegmentsX2 / 2;
+        while (uLow < uHigh)
+        {
+            UINT32 uMiddle = (uLow + uHigh) / 2;
+            if (FontReadU16(pEnds + uMiddle * 2) < uCodepoint)
+                uLow = uMiddle + 1;
+            else
+                uHigh = uMiddle;
+        }
+        if (uLow == uSegmentsX2 / 2)
+            return 0;
+
+        UINT32 uStart = FontReadU16(pStarts + uLow * 2);
+        if (uCodepoint < uStart)
+            return 0;
+
+        UINT32 uDelta = FontReadU16(pDeltas + uLow * 2);
+        UINT32 uRange = FontReadU16(pRanges + uLow * 2);
+        if (uRange == 0)
+            return (uCodepoint + uDelta) & 0xFFFF;
+
+        const BYTE* pIndex = pRanges + uLow * 2 + uRange + (uCodepoint - uStart) * 2;
+        if (pIndex + 2 > m_pCmap + m_uCmapLength)
+            return 0;
+        UINT32 uGlyph = FontReadU16(pIndex);
+        return uGlyph ? (uGlyph + uDelta) & 0xFFFF : 0;
+    }
+
+    void Font::ResolveOutlines()
+    {
+        m_bOutlinesResolved = TRUE;
+        m_pLoca = FindTable(0x6C6F6361, &m_uLocaLength); // 'loca'
+        m_pGlyf = FindTable(0x676C7966, &m_uGlyfLength); // 'glyf'
+        m_pHmtx = FindTable(0x686D7478, &m_uHmtxLength); // 'hmtx'
+        if (m_pLoca == nullptr || m_pGlyf == nullptr)
+            m_pLoca = m_pGlyf = nullptr;
+        if (m_pHmtx == nullptr || m_uMetricCount == 0 || m_uHmtxLength < m_uMetricCount * 4)
+            m_pHmtx = nullptr;
+    }
+
+    float Font::GetAdvance(UINT32 uGlyph, float fPixelSize)
+    {
+        if (!m_bOutlinesResolved)
+            ResolveOutlines();
+        if (m_pHmtx == nullptr)
+            return 0;
+
+        // Glyphs past the last long metric share its advance
+        UINT32 uAdvance = FontReadU16(m_pHmtx + (std::min)(uGlyph, m_uMetricCount - 1) * 4);
+        return uAdvance * fPixelSize / m_nUnitsPerEm;
+    }
+
+    void Font::GetOutline(UINT32 uGlyph, float fPixelSize, Path& path)
+    {
+        if (!m_bOutlinesResolved)
+            ResolveOutlines();
+
+        float fScale = fPixelSize / m_nUnitsPerEm;
+        const float matrix[6] = { fScale, 0, 0, -fScale, 0, 0 };
+        AppendOutline(path, uGlyph, matrix, 0);
+    }
+
+    void Font::AppendOutline(Path& path, UINT32 uGlyph, const float* pMatrix, int nDepth)
+    {
+        if (m_pGlyf == nullptr || uGlyph >= m_uGlyphCount || nDepth > 8)
+            return;
+
+        UINT32 uOffset, uNext;
+        if (m_bLongOffsets)
+        {
+            if ((uGlyph + 2) * 4 > m_uLocaLength)
+                return;
+            uOffset = FontReadU32(m_pLoca + uGlyph * 4);
+            uNext = FontReadU32(m_pLoca + uGlyph * 4 + 4);
+        }
+        else
+        {
+            if ((uGlyph + 2) * 2 > m_uLocaLength)
+                return;
+            uOffset = FontReadU16(m_pLoca + uGlyph * 2) * 2;
+            uNext = FontReadU16(m_pLoca + uGlyph * 2 + 2) * 2;
+        }
+        // Empty glyphs (spaces) have no data at all
+        if (uNext <= uOffset + 10 || uNext > m_uGlyfLength)
+            return;
+
+        const BYTE* p = m_pGlyf + uOffset;
+        const BYTE* pEnd = m_pGlyf + uNext;
+        int nContours = (INT16)FontReadU16(p);
+        p += 10;
+
+        if (nContours < 0)
+        {
+            // Composite glyph: components transformed into the parent space
+            UINT32 uFlags;
+            do
+            {
+                if (p + 4 > pEnd)
+                    return;
+                uFlags = FontReadU16(p);
+                UINT32 uComponent = FontReadU16(p + 2);
+                p += 4;
+
+                float dx = 0, dy = 0;
+                if (uFlags & 0x0001)
+                {
+                    if (p + 4 > pEnd)
+                        return;
+                    dx = (float)(INT16)FontReadU16(p);
+                    dy = (float)(INT16)FontReadU16(p + 2);
+                    p += 4;
+                }
+                else
+                {
+                    if (p + 2 > pEnd)
+                        return;
+                    dx = (float)(signed char)p[0];
+                    dy = (float)(signed char)p[1];
+                    p += 2;
+                }
+                // Anchor point matching is not supported, components are placed at the origin
+                if (!(uFlags & 0x0002))
+                    dx = dy = 0;
+
+                float a = 1, b = 0, c = 0, d = 1;
+                if (uFlags & 0x0008)
+                {
+                    if (p + 2 > pEnd)
+                        return;
+                    a = d = FontReadF2Dot14(p);
+                    p += 2;
+                }
+                else if (uFlags & 0x0040)
+                {
+                    if (p + 4 > pEnd)
+                        return;
+                    a = FontReadF2Dot14(p);
+                    d = FontReadF2Dot14(p + 2);
+                    p += 4;
+                }
+                else if (uFlags & 0x0080)
+                {
+                    if (p + 8 > pEnd)
+                        return;
+                    a = FontReadF2Dot14(p);
+                    b = FontReadF2Dot14(p + 2);
+                    c = FontReadF2Dot14(p + 4);
+                    d = FontReadF2Dot14(p + 6);
+                    p += 8;
+                }
+
+                const float matrix[6] = {
+                    pMatrix[0] * a + pMatrix[2] * b,
+                    pMatrix[1] * a + pMatrix[3] * b,
+                    pMatrix[0] * c + pMatrix[2] * d,
+                    pMatrix[1] * c + pMatrix[3] * d,
+                    pMatrix[0] * dx + pMatrix[2] * dy + pMatrix[4],
+                    pMatrix[1] * dx + pMatrix[3] * dy + pMatrix[5] };
+                AppendOutline(path, uComponent, matrix, nDepth + 1);
+            } while (uFlags & 0x0020);
+            return;
+        }
+
+        if (nContours == 0 || p + nContours * 2 + 2 > pEnd)
+            return;
+        const BYTE* pEndPoints = p;
+        UINT32 uPointCount = FontReadU16(pEndPoints + (nContours - 1) * 2) + 1;
+        p += nContours * 2;
+        p += 2 + FontReadU16(p);
+
+        // Flags with their repeat counts, then x and y deltas whose size depends on the flags
+        std::vector<BYTE> flags(uPointCount);
+        for (UINT32 i = 0; i < uPointCount;)
+        {
+            if (p >= pEnd)
+                return;
+            BYTE bFlag = *p++;
+            flags[i++] = bFlag;
+            if (bFlag & 0x08)
+            {
+                if (p >= pEnd)
+                    return;
+                for (UINT32 uRepeat = *p++; uRepeat > 0 && i < uPointCount; uRepeat--)
+                    flags[i++] = bFlag;
+            }
+        }
+
+        std::vector<Path::Point> points(uPointCount);
+        for (int nAxis = 0; nAxis < 2; nAxis++)
+        {
+            BYTE bShort = nAxis == 0 ? 0x02 : 0x04;
+            BYTE bSame = nAxis == 0 ? 0x10 : 0x20;
+            int nValue = 0;
+            for (UINT32 i = 0; i < uPointCount; i++)
+            {
+                if (flags[i] & bShort)
+                {
+                    if (p + 1 > pEnd)
+                        return;
+                    nValue += (flags[i] & bSame) ? *p : -(int)*p;
+                    p++;
+                }
+                else if (!(flags[i] & bSame))
+                {
+                    if (p + 2 > pEnd)
+                        return;
+                    nValue += (INT16)FontReadU16(p);
+                    p += 2;
+                }
+                (nAxis == 0 ? points[i].x : points[i].y) = (float)nValue;
+            }
+        }
+        for (Path::Point& point : points)
+            point = { pMatrix[0] * point.x + pMatrix[2] * point.y + pMatrix[4], pMatrix[1] * point.x + pMatrix[3] * point.y + pMatrix[5] };
+
+        UINT32 uStart = 0;
+        for (int nContour = 0; nContour < nContours; nContour++)
+        {
+            UINT32 uLast = FontReadU16(pEndPoints + nContour * 2);
+            if (uLast < uStart || uLast >= uPointCount)
+                return;
+
+            // Consecutive off-curve points imply an on-curve point halfway between them
+            auto Midpoint = [](const Path::Point& p0, const Path::Point& p1) -> Path::Point {
+                return { (p0.x + p1.x) * 0.5f, (p0.y + p1.y) * 0.5f };
+            };
+            UINT32 uFirst = uStart;
+            Path::Point first;
+            if (flags[uStart] & 0x01)
+            {
+                first = points[uStart];
+                uFirst = uStart + 1;
+            }
+            else if (flags[uLast] & 0x01)
+            {
+                first = points[uLast];
+                uLast--;
+            }
+            else
+            {
+                first = Midpoint(points[uStart], points[uLast]);
+            }
+
+            path.MoveTo(first.x, first.y);
+            BOOL bControl = FALSE;
+            Path::Point control = {};
+            for (UINT32 i = uFirst; i <= uLast; i++)
+            {
+                if (flags[i] & 0x01)
+                {
+                    if (bControl)
+                        path.QuadTo(control.x, control.y, points[i].x, points[i].y);
+                    else
+                        path.LineTo(points[i].x, points[i].y);
+                    bControl = FALSE;
+                }
+                else
+                {
+                    if (bControl)
+                    {
+                        Path::Point middle = Midpoint(control, points[i]);
+                        path.QuadTo(control.x, control.y, middle.x, middle.y);
+                    }
+                    control = points[i];
+                    bControl = TRUE;
+                }
+            }
+            if (bControl)
+                path.QuadTo(control.x, control.y, first.x, first.y);
+            else
+                path.LineTo(first.x, first.y);
+            path.Close();
+
+            uStart = FontReadU16(pEndPoints + nContour * 2) + 1;
+        }
+    }
+
+    const Font::Glyph& Font::GetGlyph(UINT32 uGlyph, int nPixelSize)
+    {
+        auto key = std::make_pair(uGlyph, nPixelSize);
+        auto it = m_glyphs.find(key);
+        if (it != m_glyphs.end())
+            return it->second;
+
+        Glyph glyph = {};
+        glyph.fAdvance = GetAdvance(uGlyph, (float)nPixelSize);
+
+        Path path(0.2f);
+        GetOutline(uGlyph, (float)nPixelSize, path);
+        if (!path.IsEmpty())
+        {
+            Path::Point origin = path.GetPoints().front();
+            float fLeft = origin.x, fTop = origin.y, fRight = origin.x, fBottom = origin.y;
+            for (const Path::Point& point : path.GetPoints())
+            {
+                fLeft = (std::min)(fLeft, point.x);
+                fTop = (std::min)(fTop, point.y);
+                fRight = (std::max)(fRight, point.x);
+                fBottom = (std::max)(fBottom, point.y);
+            }
+            glyph.nLeft = (int)floorf(fLeft);
+            glyph.nTop = (int)floorf(fTop);
+            glyph.nWidth = (int)ceilf(fRight) - glyph.nLeft;
+            glyph.nHeight = (int)ceilf(fBottom) - glyph.nTop;
+            if (glyph.nWidth > 0 && glyph.nHeight > 0)
+            {
+                glyph.coverage.resize((SIZE_T)glyph.nWidth * glyph.nHeight);
+                m_rasterizer.Reset(glyph.nWidth, glyph.nHeight);
+                m_rasterizer.AddPath(path, 1.0f, 1.0f, (float)-glyph.nLeft, (float)-glyph.nTop);
+                m_rasterizer.Resolve(glyph.coverage.data(), glyph.nWidth);
+            }
+        }
+
+        return m_glyphs.emplace(key, std::move(glyph)).first->second;
+    }
+
+    float Font::DrawString(const Surface& dst, float x, float y, const wchar_t* pText, SIZE_T length, int nPixelSize,
+        UINT32 uColor, BlendMode mode)
+    {
+        int nBaseline = (int)floorf(y + 0.5f);
+        for (SIZE_T i = 0; i < length;)
+        {
+            const Glyph& glyph = GetGlyph(GetGlyphIndex(FontNextCodepoint(pText, length, i)), nPixelSize);
+            if (!glyph.coverage.empty())
+            {
+                FillMask(dst, (int)floorf(x + 0.5f) + glyph.nLeft, nBaseline + glyph.nTop, glyph.coverage.data(),
+                    glyph.nWidth, glyph.nHeight, glyph.nWidth, uColor, mode);
+            }
+            x += glyph.fAdvance;
+        }
+        return x;
+    }
+
+    /*=========================================================================
+     * SdfFont implementation
+     *=========================================================================*/
+    SdfFont::SdfFont(Font& font, int nBaseSize, int nSpread, int nAtlasWidth, int nAtlasHeight, UINT uThreadCount)
+        : m_font(font), m_nBaseSize(nBaseSize), m_nSpread((std::max)(nSpread, 1)), m_nAtlasWidth(nAtlasWidth),
+        m_nAtlasHeight(nAtlasHeight), m_atlas((SIZE_T)nAtlasWidth * nAtlasHeight), m_packer(nAtlasWidth, nAtlasHeight)
+    {
+        m_uThreadCount = uThreadCount ? uThreadCount : (std::max)(1u, std::thread::hardware_concurrency());
+    }
+
+    void SdfFont::Clear()
+    {
+        m_entries.clear();
+        m_packer.Clear();
+    }
+
+    void SdfFont::Generate(Job& job, Rasterizer& rasterizer) const
+    {
+        // Inside and outside come from the coverage, the distance from the closest outline segment
+        job.field.resize((SIZE_T)job.nWidth * job.nHeight);
+        rasterizer.Reset(job.nWidth, job.nHeight);
+        rasterizer.AddPath(job.outline, 1.0f, 1.0f, (float)-job.nLeft, (float)-job.nTop);
+        rasterizer.Resolve(job.field.data(), job.nWidth);
+
+        const std::vector<Path::Point>& points = job.outline.GetPoints();
+        float fLimit = (float)(m_nSpread * m_nSpread);
+        float fEncode = 127.0f / m_nSpread;
+        for (int y = 0; y < job.nHeight; y++)
+        {
+            float fY = job.nTop + y + 0.5f;
+            for (int x = 0; x < job.nWidth; x++)
+            {
+                float fX = job.nLeft + x + 0.5f;
+                float fClosest = fLimit;
+                UINT32 uStart = 0;
+                for (const Path::Contour& contour : job.outline.GetContours())
+                {
+                    for (UINT32 i = uStart; i < contour.uEnd; i++)
+                    {
+                        const Path::Point& p0 = points[i];
+                        const Path::Point& p1 = points[i + 1 < contour.uEnd ? i + 1 : uStart];
+                        float fDx = p1.x - p0.x, fDy = p1.y - p0.y;
+                        float fLength = fDx * fDx + fDy * fDy;
+                        float t = fLength > 0 ? ((fX - p0.x) * fDx + (fY - p0.y) * fDy) / fLength : 0;
+                        t = (std::min)((std::max)(t, 0.0f), 1.0f);
+                        float fOffsetX = p0.x + t * fDx - fX, fOffsetY = p0.y + t * fDy - fY;
+                        fClosest = (std::min)(fClosest, fOffsetX * fOffsetX + fOffsetY * fOffsetY);
+                    }
+                    uStart = contour.uEnd;
+                }
+
+                BYTE& bValue = job.field[(SIZE_T)y * job.nWidth + x];
+                float fDistance = sqrtf(fClosest) * fEncode;
+                bValue = (BYTE)(std::min)(255.0f, (std::max)(0.0f, bValue >= 128 ? 128.0f + fDistance : 128.0f - fDistance));
+            }
+        }
+    }
+
+    BOOL SdfFont::PrepareGlyphs(const wchar_t* pText, SIZE_T length)
+    {
+        // Outlines are read on this thread, only the fields are computed by the workers
+        std::vector<Job> jobs;
+        for (SIZE_T i = 0; i < length;)
+        {
+            UINT32 uGlyph = m_font.GetGlyphIndex(FontNextCodepoint(pText, length, i));
+            if (m_entries.count(uGlyph))
+                continue;
+
+            Job job = { uGlyph, Path(0.1f), 0, 0, 0, 0, {} };
+            m_font.GetOutline(uGlyph, (float)m_nBaseSize, job.outline);
+            if (job.outline.IsEmpty())
+            {
+                m_entries[uGlyph] = {};
+                continue;
+            }
+
+            Path::Point origin = job.outline.GetPoints().front();
+            float fLeft = origin.x, fTop = origin.y, fRight = origin.x, fBottom = origin.y;
+            for (const Path::Point& point : job.outline.GetPoints())
+            {
+                fLeft = (std::min)(fLeft, point.x);
+                fTop = (std::min)(fTop, point.y);
+                fRight = (std::max)(fRight, point.x);
+                fBottom = (std::max)(fBottom, point.y);
+            }
+            job.nLeft = (int)floorf(fLeft) - m_nSpread;
+            job.nTop = (int)floorf(fTop) - m_nSpread;
+            job.nWidth = (int)ceilf(fRight) + m_nSpread - job.nLeft;
+            job.nHeight = (int)ceilf(fBottom) + m_nSpread - job.nTop;
+
+            // Placeholder so repeated glyphs of the text are generated once
+            m_entries[uGlyph] = {};
+            jobs.push_back(std::move(job));
+        }
+        if (jobs.empty())
+            return TRUE;
+
+        std::atomic<SIZE_T> nNextJob{ 0 };
+        auto Worker = [&]
+        {
+            Rasterizer rasterizer;
+            for (SIZE_T nJob = nNextJob++; nJob < jobs.size(); nJob = nNextJob++)
+                Generate(jobs[nJob], rasterizer);
+        };
+
+        std::vector<std::thread> threads;
+        UINT uThreadCount = (std::min<SIZE_T>)(m_uThreadCount, jobs.size());
+        for (UINT i = 1; i < uThreadCount; i++)
+            threads.emplace_back(Worker);
+        Worker();
+        for (std::thread& thread : threads)
+            thread.join();
+
+        BOOL bFits = TRUE;
+        for (Job& job : jobs)
+        {
+            Entry& entry = m_entries[job.uGlyph];
+            if (!m_packer.Allocate(job.nWidth, job.nHeight, entry.rcAtlas))
+            {
+                m_entries.erase(job.uGlyph);
+                bFits = FALSE;
+                continue;
+            }
+
+            entry.nLeft = job.nLeft;
+            entry.nTop = job.nTop;
+            for (int nRow = 0; nRow < job.nHeight; nRow++)
+            {
+                memcpy(&m_atlas[(SIZE_T)(entry.rcAtlas.top + nRow) * m_nAtlasWidth + entry.rcAtlas.left],
+                    &job.field[(SIZE_T)nRow * job.nWidth], job.nWidth);
+            }
+        }
+        return bFits;
+    }
+
+    void SdfFont::Prepare(const wchar_t* pText, SIZE_T length)
+    {
+        if (!PrepareGlyphs(pText, length))
+        {
+            Clear();
+            PrepareGlyphs(pText, length);
+        }
+    }
+
+    float SdfFont::DrawString(const Surface& dst, float x, float y, const wchar_t* pText, SIZE_T length, float fPixelSize,
+        UINT32 uColor, BlendMode mode)
+    {
+        Prepare(pText, length);
+
+        // Field levels to destination pixels, the edge being at 128
+        float fScale = fPixelSize / m_nBaseSize;
+        float fDecode = m_nSpread * fScale / 127.0f;
+        for (SIZE_T i = 0; i < length;)
+        {
+            UINT32 uGlyph = m_font.GetGlyphIndex(FontNextCodepoint(pText, length, i));
+            auto it = m_entries.find(uGlyph);
+            float fAdvance = m_font.GetAdvance(uGlyph, fPixelSize);
+            if (it == m_entries.end() || it->second.rcAtlas.right == it->second.rcAtlas.left)
+            {
+                x += fAdvance;
+                continue;
+            }
+
+            const Entry& entry = it->second;
+            int nFieldWidth = entry.rcAtlas.right - entry.rcAtlas.left;
+            int nFieldHeight = entry.rcAtlas.bottom - entry.rcAtlas.top;
+            float fLeft = x + entry.nLeft * fScale;
+            float fTop = y + entry.nTop * fScale;
+            int nLeft = (int)floorf(fLeft);
+            int nTop = (int)floorf(fTop);
+            int nWidth = (int)ceilf(fLeft + nFieldWidth * fScale) - nLeft;
+            int nHeight = (int)ceilf(fTop + nFieldHeight * fScale) - nTop;
+            x += fAdvance;
+            if (nLeft >= dst.nWidth || nTop >= dst.nHeight || nLeft + nWidth <= 0 || nTop + nHeight <= 0)
+                continue;
+
+            m_coverage.resize((SIZE_T)nWidth * nHeight);
+            const BYTE* pField = &m_atlas[(SIZE_T)entry.rcAtlas.top * m_nAtlasWidth + entry.rcAtlas.left];
+            for (int nRow = 0; nRow < nHeight; nRow++)
+            {
+                float fV = (std::min)((std::max)((nTop + nRow + 0.5f - fTop) / fScale - 0.5f, 0.0f), nFieldHeight - 1.0f);
+                int nV = (std::min)((int)fV, nFieldHeight - 2 < 0 ? 0 : nFieldHeight - 2);
+                float fWeightV = fV - nV;
+                const BYTE* pRow0 = pField + (SIZE_T)nV * m_nAtlasWidth;
+                const BYTE* pRow1 = nFieldHeight > 1 ? pRow0 + m_nAtlasWidth : pRow0;
+                BYTE* pCoverage = &m_coverage[(SIZE_T)nRow * nWidth];
+                for (int nColumn = 0; nColumn < nWidth; nColumn++)
+                {
+                    float fU = (std::min)((std::max)((nLeft + nColumn + 0.5f - fLeft) / fScale - 0.5f, 0.0f), nFieldWidth - 1.0f);
+                    int nU = (std::min)((int)fU, nFieldWidth - 2 < 0 ? 0 : nFieldWidth - 2);
+                    int nU1 = nFieldWidth > 1 ? nU + 1 : nU;
+                    float fWeightU = fU - nU;
+                    float fTopValue = pRow0[nU] + (pRow0[nU1] - pRow0[nU]) * fWeightU;
+                    float fBottomValue = pRow1[nU] + (pRow1[nU1] - pRow1[nU]) * fWeightU;
+                    float fDistance = (fTopValue + (fBottomValue - fTopValue) * fWeightV - 128.0f) * fDecode;
+                    pCoverage[nColumn] = (BYTE)((std::min)((std::max)(fDistance + 0.5f, 0.0f), 1.0f) * 255.0f + 0.5f);
+                }
+            }
+            FillMask(dst, nLeft, nTop, m_coverage.data(), nWidth, nHeight, nWidth, uColor, mode);
+        }
+        return x;
+    }
+
+    /*=========================================================================
+     * FormatBuffer implementation
+     *=========================================================================*/
+    template<SIZE_T Capacity>
+    FormatBuffer<Capacity>& FormatBuffer<Capacity>::Clear()
+    {
+        m_length = 0;
+        m_text[0] = L'\0';
+        return *this;
+    }
+
+    template<SIZE_T Capacity>
+    FormatBuffer<Capacity>& FormatBuffer<Capacity>::AppendChars(const char* pFirst, const char* pLast)
+    {
+        while (pFirst < pLast && m_length < Capacity)
+            m_text[m_length++] = (wchar_t)*pFirst++;
+        m_text[m_length] = L'\0';
+        return *this;
+    }
+
+    template<SIZE_T Capacity>
+    FormatBuffer<Capacity>& FormatBuffer<Capacity>::Append(const wchar_t* pText)
+    {
+        while (*pText && m_length < Capacity)
+            m_text[m_length++] = *pText++;
+        m_text[m_length] = L'\0';
+        return *this;
+    }
+
+    template<SIZE_T Capacity>
+    FormatBuffer<Capacity>& FormatBuffer<Capacity>::Append(const wchar_t* pText, SIZE_T length)
+    {
+        length = (std::min)(length, Capacity - m_length);
+        memcpy(m_text + m_length, pText, length * sizeof(wchar_t));
+        m_length += length;
+        m_text[m_length] = L'\0';
+        return *this;
+    }
+
+    template<SIZE_T Capacity>
+    FormatBuffer<Capacity>& FormatBuffer<Capacity>::Append(wchar_t c)
+    {
+        if (m_length < Capacity)
+            m_text[m_length++] = c;
+        m_text[m_length] = L'\0';
+        return *this;
+    }
+
+    template<SIZE_T Capacity>
+    FormatBuffer<Capacity>& FormatBuffer<Capacity>::Append(char c)
+    {
+        return Append((wchar_t)(unsigned char)c);
+    }
+
+    template<SIZE_T Capacity>
+    FormatBuffer<Capacity>& FormatBuffer<Capacity>::Append(bool bValue)
+    {
+        return Append(bValue ? L"true" : L"false");
+    }
+
+    template<SIZE_T Capacity>
+    FormatBuffer<Capacity>& FormatBuffer<Capacity>::Append(float fValue)
+    {
+        char buffer[32];
+        std::to_chars_result result = std::to_chars(buffer, buffer + sizeof(buffer), fValue);
+        return AppendChars(buffer, result.ptr);
+    }
+
+    template<SIZE_T Capacity>
+    FormatBuffer<Capacity>& FormatBuffer<Capacity>::Append(double dValue)
+    {
+        char buffer[32];
+        std::to_chars_result result = std::to_chars(buffer, buffer + sizeof(buffer), dValue);
+        return AppendChars(buffer, result.ptr);
+    }
+
+    template<SIZE_T Capacity>
+    template<class T, std::enable_if_t<std::is_integral_v<T> && !std::is_same_v<T, wchar_t>
+        && !std::is_same_v<T, char> && !std::is_same_v<T, bool>, int>>
+    FormatBuffer<Capacity>& FormatBuffer<Capacity>::Append(T value)
+    {
+        char buffer[24];
+        std::to_chars_result result = std::to_chars(buffer, buffer + sizeof(buffer), value);
+        return AppendChars(buffer, result.ptr);
+    }
+
+    template<SIZE_T Capacity>
+    template<class T, std::enable_if_t<std::is_integral_v<T> && !std::is_same_v<T, bool>, int>>
+    FormatBuffer<Capacity>& FormatBuffer<Capacity>::AppendPadded(T value, int nWidth, wchar_t cFill)
+    {
+        char buffer[24];
+        std::to_chars_result result = std::to_chars(buffer, buffer + sizeof(buffer), value);
+        for (int i = (int)(result.ptr - buffer); i < nWidth; i++)
+            Append(cFill);
+        return AppendChars(buffer, result.ptr);
+    }
+
+    template<SIZE_T Capacity>
+    FormatBuffer<Capacity>& FormatBuffer<Capacity>::AppendFixed(double dValue, int nDecimals)
+    {
+        char buffer[64];
+        std::to_chars_result result = std::to_chars(buffer, buffer + sizeof(buffer), dValue, std::chars_format::fixed, nDecimals);
+        if (result.ec != std::errc())
+            return Append(dValue);
+        return AppendChars(buffer, result.ptr);
+    }
+
+    template<SIZE_T Capacity>
+    FormatBuffer<Capacity>& FormatBuffer<Capacity>::AppendDuration(double dSeconds)
+    {
+        static const struct
+        {
+            double dScale;
+            const wchar_t* pUnit;
+        } units[] = { { 1e9, L" ns" }, { 1e6, L" \u00B5s" }, { 1e3, L" ms" }, { 1.0, L" s" } };
+
+        double dMagnitude = fabs(dSeconds);
+        int nUnit = dMagnitude < 1e-6 ? 0 : dMagnitude < 1e-3 ? 1 : dMagnitude < 1.0 ? 2 : 3;
+        // Values rounding up to 1000 belong to the next unit
+        if (nUnit < 3 && dMagnitude * units[nUnit].dScale >= 999.5)
+            nUnit++;
+        double dValue = dSeconds * units[nUnit].dScale;
+        double dScaled = fabs(dValue);
+        AppendFixed(dValue, nUnit == 0 || dScaled >= 99.95 ? 0 : dScaled >= 9.995 ? 1 : 2);
+        return Append(units[nUnit].pUnit);
+    }
+
+    /*=========================================================================
+     * Logger implementation
+     *=========================================================================*/
+    std::atomic<UINT64> Logger::s_ulNextId{ 1 };
+
+    Logger::Logger(LPCWSTR lpFileName, DWORD dwInterval) : m_ulId(s_ulNextId++), m_dwInterval(dwInterval)
+    {
+        if (lpFileName)
+        {
+            m_hFile = CreateFileW(lpFileName, FILE_APPEND_DATA, FILE_SHARE_READ, NULL, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+            if (m_hFile == INVALID_HANDLE_VALUE)
+                throw ApplicationException(L"Failed to open the log file (CreateFileW)");
+        }
+
+        m_hWakeEvent = CreateEventW(NULL, FALSE, FALSE, NULL);
+        if (m_hWakeEvent == NULL)
+        {
+            if (m_hFile != INVALID_HANDLE_VALUE)
+                CloseHandle(m_hFile);
+            throw ApplicationException(L"Failed to create the logger event (CreateEventW)");
+        }
+
+        LARGE_INTEGER liFrequency = {}, liNow = {};
+        QueryPerformanceFrequency(&liFrequency);
+        QueryPerformanceCounter(&liNow);
+        m_dTickPeriod = 1.0 / liFrequency.QuadPart;
+        m_llStart = liNow.QuadPart;
+
+        m_thread = std::thread(&Logger::Run, this);
+    }
+
+    Logger::~Logger()
+    {
+        m_bStop = TRUE;
+        SetEvent(m_hWakeEvent);
+        m_thread.join();
+
+        CloseHandle(m_hWakeEvent);
+        if (m_hFile != INVALID_HANDLE_VALUE)
+            CloseHandle(m_hFile);
+    }
+
+    template<class T>
+    void Logger::AddArgument(Record& record, const T& value)
+    {
+        Argument& argument = record.arguments[record.uArgumentCount++];
+        if constexpr (std::is_convertible_v<const T&, std::wstring_view>)
+        {
+            // Copied as the caller's buffer may be gone by the time the record is formatted
+            std::wstring_view text;
+            if constexpr (std::is_pointer_v<T>)
+                text = value ? std::wstring_view(value) : std::wstring_view(L"(null)");
+            else
+                text = value;
+            UINT32 uLength = (UINT32)(std::min)(text.size(), (SIZE_T)(s_uStringCapacity - record.uStringLength));
+            memcpy(record.strings + record.uStringLength, text.data(), uLength * sizeof(wchar_t));
+            argument.type = Argument::Type::String;
+            argument.string = { record.uStringLength, uLength };
+            record.uStringLength += uLength;
+        }
+        else if constexpr (std::is_floating_point_v<T>)
+        {
+            argument.type = Argument::Type::Float;
+            argument.dFloat = value;
+        }
+        else if constexpr (std::is_signed_v<T> || std::is_enum_v<T>)
+        {
+            argument.type = Argument::Type::Signed;
+            argument.llSigned = (LONGLONG)value;
+        }
+        else
+        {
+            static_assert(std::is_unsigned_v<T>, "Log arguments must be numbers or wide strings");
+            argument.type = Argument::Type::Unsigned;
+            argument.ullUnsigned = value;
+        }
+    }
+
+    template<class... Args>
+    void Logger::Log(const wchar_t* pFormat, const Args&... args)
+    {
+        static_assert(sizeof...(Args) <= s_uMaxArguments, "Too many log arguments");
+
+        Ring& ring = GetRing();
+        UINT64 ulHead = ring.ulHead.load(std::memory_order_relaxed);
+        if (ulHead - ring.ulTail.load(std::memory_order_acquire) >= s_uRecordCount)
+        {
+            m_ulDropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+
+        Record& record = ring.records[ulHead & (s_uRecordCount - 1)];
+        LARGE_INTEGER liNow;
+        QueryPerformanceCounter(&liNow);
+        record.pFormat = pFormat;
+        record.llTimestamp = liNow.QuadPart;
+        record.uArgumentCount = 0;
+        record.uStringLength = 0;
+        (AddArgument(record, args), ...);
+        ring.ulHead.store(ulHead + 1, std::memory_order_release);
+    }
+
+    Logger::RingOwner::~RingOwner()
+    {
+        for (const std::shared_ptr<Ring>& pRing : rings)
+            pRing->bReleased.store(TRUE, std::memory_order_release);
+    }
+
+    Logger::Ring& Logger::GetRing()
+    {
+        // The last logger used by the thread is remembered, the others are found among the rings of the thread
+        thread_local UINT64 ulCachedId = 0;
+        thread_local Ring* pCachedRing = nullptr;
+        thread_local RingOwner owner;
+        if (ulCachedId == m_ulId)
+            return *pCachedRing;
+
+        auto it = std::find_if(owner.rings.begin(), owner.rings.end(),
+            [&](const std::shared_ptr<Ring>& pRing) { return pRing->ulLoggerId == m_ulId; });
+        if (it == owner.rings.end())
+        {
+            // Rings only referenced here belong to destroyed loggers
+            owner.rings.erase(std::remove_if(owner.rings.begin(), owner.rings.end(),
+                [](const std::shared_ptr<Ring>& pRing) { return pRing.use_count() == 1; }), owner.rings.end());
+
+            std::lock_guard<std::mutex> lock(m_mutex);
+            auto free = std::find_if(m_rings.begin(), m_rings.end(), [](const std::shared_ptr<Ring>& pRing) { return pRing->bFree; });
+            std::shared_ptr<Ring> pRing;
+            if (free != m_rings.end())
+            {
+                pRing = *free;
+                pRing->bFree = FALSE;
+                pRing->bReleased.store(FALSE, std::memory_order_relaxed);
             }
-            return TRUE;
+            else
+            {
+                pRing = std::make_shared<Ring>();
+                m_rings.push_back(pRing);
+            }
+            pRing->dwThreadId = GetCurrentThreadId();
+            pRing->ulLoggerId = m_ulId;
+            owner.rings.push_back(std::move(pRing));
+            it = std::prev(owner.rings.end());
+        }
 
-            // Keyboard handling
-            case WM_KEYDOWN: pDerivedType->OnKeyDown(wParam); return TRUE;
-            case WM_KEYUP: pDerivedType->OnKeyUp(wParam); return TRUE;
+        ulCachedId = m_ulId;
+        pCachedRing = it->get();
+        return *pCachedRing;
+    }
 
-            // Mouse handling
-            case WM_LBUTTONDOWN: pDerivedType->OnMouseButtonDown(VK_LBUTTON); return TRUE;
-            case WM_MBUTTONDOWN: pDerivedType->OnMouseButtonDown(VK_MBUTTON); return TRUE;
-            case WM_RBUTTONDOWN: pDerivedType->OnMouseButtonDown(VK_RBUTTON); return TRUE;
-            case WM_LBUTTONUP: pDerivedType->OnMouseButtonUp(VK_LBUTTON); return TRUE;
-            case WM_MBUTTONUP: pDerivedType->OnMouseButtonUp(VK_MBUTTON); return TRUE;
-            case WM_RBUTTONUP: pDerivedType->OnMouseButtonUp(VK_RBUTTON); return TRUE;
-            case WM_MOUSEMOVE:
+    void Logger::Flush()
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        UINT64 ulRequest = ++m_ulFlushRequested;
+        SetEvent(m_hWakeEvent);
+        m_flushed.wait(lock, [&] { return m_ulFlushCompleted >= ulRequest; });
+    }
+
+    void Logger::Format(FormatBuffer<1024>& line, const Record& record, DWORD dwThreadId) const
+    {
+        line.Clear().Append(L'[').AppendFixed((record.llTimestamp - m_llStart) * m_dTickPeriod, 6).Append(L"] ");
+        line.Append(dwThreadId).Append(L": ");
+
+        UINT32 uArgument = 0;
+        for (const wchar_t* p = record.pFormat; *p; p++)
+        {
+            if (p[0] != L'{' || p[1] != L'}' || uArgument == record.uArgumentCount)
             {
-                int x = GET_X_LPARAM(lParam);
-                int y = GET_Y_LPARAM(lParam);
-                pDerivedType->OnMouseMove(x, y);
+                line.Append(*p);
+                continue;
             }
-            return TRUE;
 
-            // Close handling
-            case WM_CLOSE:
+            const Argument& argument = record.arguments[uArgument++];
+            switch (argument.type)
             {
-                pDerivedType->OnClose();
-                PostQuitMessage(0);
+            case Argument::Type::Signed:
+                line.Append(argument.llSigned);
+                break;
+            case Argument::Type::Unsigned:
+                line.Append(argument.ullUnsigned);
+                break;
+            case Argument::Type::Float:
+                line.Append(argument.dFloat);
+                break;
+            case Argument::Type::String:
+                line.Append(record.strings + argument.string.uOffset, argument.string.uLength);
+                break;
             }
-            return TRUE;
+            p++;
+        }
+    }
 
-            // Handle other messages that are not handled by SWL
-            default:
-                if (pDerivedType->HandleOtherMessages(uMsg))
-                    return TRUE;
+    void Logger::Write(const FormatBuffer<1024>& line)
+    {
+        // The line break is added here so that a record filling the whole line still ends with one
+        if (m_hFile == INVALID_HANDLE_VALUE)
+        {
+            OutputDebugStringW(line.GetText());
+            OutputDebugStringW(L"\n");
+            return;
+        }
+
+        // Batched as UTF-8 and written once per drain
+        SIZE_T offset = m_output.size();
+        m_output.resize(offset + line.GetLength() * 3);
+        int nBytes = WideCharToMultiByte(CP_UTF8, 0, line.GetText(), (int)line.GetLength(), &m_output[offset],
+            (int)(m_output.size() - offset), NULL, NULL);
+        m_output.resize(offset + (std::max)(nBytes, 0));
+        m_output.push_back('\n');
+    }
+
+    void Logger::Drain()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_snapshot.clear();
+            for (const std::shared_ptr<Ring>& pRing : m_rings)
+            {
+                if (!pRing->bFree)
+                    m_snapshot.push_back(pRing.get());
             }
         }
 
-        return DefWindowProc(hWnd, uMsg, wParam, lParam);
+        FormatBuffer<1024> line;
+        for (Ring* pRing : m_snapshot)
+        {
+            // Read before the head, a released ring is then known to be empty once drained
+            BOOL bReleased = pRing->bReleased.load(std::memory_order_acquire);
+            UINT64 ulTail = pRing->ulTail.load(std::memory_order_relaxed);
+            UINT64 ulHead = pRing->ulHead.load(std::memory_order_acquire);
+            for (; ulTail != ulHead; ulTail++)
+            {
+                Format(line, pRing->records[ulTail & (s_uRecordCount - 1)], pRing->dwThreadId);
+                Write(line);
+            }
+            pRing->ulTail.store(ulTail, std::memory_order_release);
+
+            if (bReleased)
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                pRing->bFree = TRUE;
+            }
+        }
+
+        UINT64 ulDropped = m_ulDropped.load(std::memory_order_relaxed);
+        if (ulDropped != m_ulDroppedReported)
+        {
+            line.Clear().Append(ulDropped - m_ulDroppedReported).Append(L" log records dropped");
+            Write(line);
+            m_ulDroppedReported = ulDropped;
+        }
+
+        if (!m_output.empty())
+        {
+            DWORD dwWritten = 0;
+            WriteFile(m_hFile, m_output.data(), (DWORD)m_output.size(), &dwWritten, NULL);
+            m_output.clear();
+        }
     }
 
-    template<class DerivedType>
-    void Application<DerivedType>::WaitMessage()
+    void Logger::Run()
     {
-        MSG msg = {};
-        if (GetMessageW(&msg, NULL, 0, 0) == -1)
-            throw ApplicationException(L"Failed to get a message (GetMessageW)");
-        TranslateMessage(&msg);
-        DispatchMessageW(&msg);
+        for (;;)
+        {
+            // Flush requests are read first, so everything logged before them is drained below
+            BOOL bStop = m_bStop.load();
+            UINT64 ulRequest;
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                ulRequest = m_ulFlushRequested;
+            }
+
+            Drain();
+
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_ulFlushCompleted = ulRequest;
+            }
+            m_flushed.notify_all();
+
+            if (bStop)
+                break;
+            WaitForSingleObject(m_hWakeEvent, m_dwInterval);
+        }
+    }
+
+    /*=========================================================================
+     * Pool implementation
+     *=========================================================================*/
+    template<class T>
+    template<class... ArgTypes>
+    Handle<T> Pool<T>::Create(ArgTypes&&... args)
+    {
+        UINT32 uSlot = m_uFreeHead != s_uNone ? m_uFreeHead : (UINT32)m_slots.size();
+        if (uSlot == s_uMaxSlots)
+            throw ApplicationException(L"Failed to create a pool object, all the slots are in use (Pool::Create)");
+
+        // Nothing is taken from the free list until the object was constructed
+        m_owners.push_back(uSlot);
+        try
+        {
+            m_objects.emplace_back(std::forward<ArgTypes>(args)...);
+            if (uSlot == m_slots.size())
+                m_slots.push_back({ s_uFree | s_uNone, 1 });
+        }
+        catch (...)
+        {
+            if (m_objects.size() == m_owners.size())
+                m_objects.pop_back();
+            m_owners.pop_back();
+            throw;
+        }
+
+        Slot& slot = m_slots[uSlot];
+        if (uSlot == m_uFreeHead)
+            m_uFreeHead = slot.uDense & ~s_uFree;
+        slot.uDense = (UINT32)m_objects.size() - 1;
+        return { slot.uGeneration << 20 | uSlot };
     }
 
-    template<class DerivedType>
-    void Application<DerivedType>::PollMessage()
+    template<class T>
+    BOOL Pool<T>::Destroy(Handle<T> handle)
     {
-        MSG msg = {};
-        PeekMessageW(&msg, NULL, 0, 0, PM_REMOVE);
-        TranslateMessage(&msg);
-        DispatchMessageW(&msg);
+        if (!IsValid(handle))
+            return FALSE;
+
+        // The last object fills the hole
+        UINT32 uSlot = handle.GetIndex();
+        UINT32 uDense = m_slots[uSlot].uDense;
+        UINT32 uLast = (UINT32)m_objects.size() - 1;
+        if (uDense != uLast)
+        {
+            m_objects[uDense] = std::move(m_objects[uLast]);
+            m_owners[uDense] = m_owners[uLast];
+            m_slots[m_owners[uDense]].uDense = uDense;
+        }
+        m_objects.pop_back();
+        m_owners.pop_back();
+
+        Slot& slot = m_slots[uSlot];
+        slot.uDense = s_uFree | s_uNone;
+        if (++slot.uGeneration <= s_uMaxGeneration)
+        {
+            slot.uDense = s_uFree | m_uFreeHead;
+            m_uFreeHead = uSlot;
+        }
+        return TRUE;
+    }
+
+    template<class T>
+    void Pool<T>::Clear()
+    {
+        // Destroyed from the back so that no object is moved, every handle going stale
+        while (!m_objects.empty())
+            Destroy(GetHandle(m_objects.size() - 1));
+    }
+
+    template<class T>
+    BOOL Pool<T>::IsValid(Handle<T> handle) const
+    {
+        // Free slots already carry the generation of their next handle
+        UINT32 uSlot = handle.GetIndex();
+        return handle && uSlot < m_slots.size() && m_slots[uSlot].uGeneration == handle.GetGeneration()
+            && (m_slots[uSlot].uDense & s_uFree) == 0;
+    }
+
+    template<class T>
+    Handle<T> Pool<T>::GetHandle(SIZE_T index) const
+    {
+        UINT32 uSlot = m_owners[index];
+        return { m_slots[uSlot].uGeneration << 20 | uSlot };
+    }
+
+    /*=========================================================================
+     * AssetLoader implementation
+     *=========================================================================*/
+    AssetLoader::AssetLoader(HWND hWnd, UINT uThreadCount) : m_hWnd(hWnd)
+    {
+        uThreadCount = uThreadCount ? uThreadCount : (std::max)(1u, std::thread::hardware_concurrency());
+        for (UINT i = 0; i < uThreadCount; i++)
+            m_threads.emplace_back(&AssetLoader::Run, this);
+    }
+
+    AssetLoader::~AssetLoader()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_bStop = TRUE;
+        }
+        m_condition.notify_all();
+        for (std::thread& thread : m_threads)
+            thread.join();
+    }
+
+    template<class DecodeType, class DeliverType>
+    AssetLoader::AssetHandle AssetLoader::Load(LPCWSTR lpPath, AssetPriority priority, DecodeType decode, DeliverType deliver)
+    {
+        using AssetType = std::decay_t<std::invoke_result_t<DecodeType&, std::vector<BYTE>&>>;
+
+        Job job = {};
+        job.path = lpPath;
+        job.priority = priority;
+        job.decode = [decode = std::move(decode), deliver = std::move(deliver)](std::vector<BYTE>* pBytes, BOOL* pbLoaded) mutable
+        {
+            // Shared so that the delivery stays copyable as std::function requires
+            std::shared_ptr<AssetType> pAsset;
+            if (pBytes)
+            {
+                try
+                {
+                    pAsset = std::make_shared<AssetType>(decode(*pBytes));
+                }
+                catch (...)
+                {
+                    pAsset = nullptr;
+                }
+            }
+            *pbLoaded = pAsset != nullptr;
+            return Delivery([deliver = std::move(deliver), pAsset]() mutable { deliver(pAsset.get()); });
+        };
+
+        Handle<Job> handle = {};
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            handle = m_jobs.Create(std::move(job));
+            Enqueue(handle, priority);
+            m_progress.uRequested++;
+            if (priority == AssetPriority::FirstFrame)
+                m_progress.uFirstFrameRequested++;
+        }
+        m_condition.notify_one();
+        return handle;
+    }
+
+    void AssetLoader::Enqueue(Handle<Job> job, AssetPriority priority)
+    {
+        // Entries left behind by Reprioritize and Cancel are skipped when popped
+        m_queues[(UINT)priority].push_back(job);
+    }
+
+    BOOL AssetLoader::Cancel(AssetHandle asset)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        Job* pJob = m_jobs.Get(asset);
+        if (pJob == nullptr || pJob->bCancelled)
+            return FALSE;
+
+        m_progress.uRequested--;
+        if (pJob->priority == AssetPriority::FirstFrame)
+            m_progress.uFirstFrameRequested--;
+        if (pJob->bStarted)
+            pJob->bCancelled = TRUE;
+        else
+            m_jobs.Destroy(asset);
+        return TRUE;
+    }
+
+    BOOL AssetLoader::Reprioritize(AssetHandle asset, AssetPriority priority)
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            Job* pJob = m_jobs.Get(asset);
+            if (pJob == nullptr || pJob->bCancelled)
+                return FALSE;
+
+            Job& job = *pJob;
+            if (job.priority == priority)
+                return TRUE;
+            if (job.priority == AssetPriority::FirstFrame)
+                m_progress.uFirstFrameRequested--;
+            if (priority == AssetPriority::FirstFrame)
+                m_progress.uFirstFrameRequested++;
+            job.priority = priority;
+            if (!job.bStarted)
+                Enqueue(asset, priority);
+        }
+        m_condition.notify_one();
+        return TRUE;
+    }
+
+    void AssetLoader::Deliver()
+    {
+        BOOL bDelivered = FALSE;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_delivering.clear();
+            m_delivering.swap(m_results);
+            for (Result& result : m_delivering)
+            {
+                Job* pJob = m_jobs.Get(result.job);
+                if (!pJob->bCancelled)
+                {
+                    m_progress.uDelivered++;
+                    if (!result.bLoaded)
+                        m_progress.uFailed++;
+                    if (pJob->priority == AssetPriority::FirstFrame)
+                        m_progress.uFirstFrameDelivered++;
+                    bDelivered = TRUE;
+                }
+                else
+                {
+                    result.deliver = nullptr;
+                }
+                m_jobs.Destroy(result.job);
+            }
+        }
+
+        // Callbacks run unlocked so they can start, cancel or reprioritize loads
+        for (Result& result : m_delivering)
+        {
+            if (result.deliver)
+                result.deliver();
+        }
+        m_delivering.clear();
+
+        if (bDelivered && m_progressCallback)
+            m_progressCallback(GetProgress());
+    }
+
+    AssetProgress AssetLoader::GetProgress() const
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_progress;
+    }
+
+    BOOL AssetLoader::IsFirstFrameReady() const
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_progress.uFirstFrameDelivered == m_progress.uFirstFrameRequested;
+    }
+
+    BOOL AssetLoader::ReadAsset(LPCWSTR lpPath, std::vector<BYTE>& bytes)
+    {
+        HANDLE hFile = CreateFileW(lpPath, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+            FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+        if (hFile == INVALID_HANDLE_VALUE)
+            return FALSE;
+
+        LARGE_INTEGER liSize = {};
+        DWORD dwRead = 0;
+        BOOL bRead = GetFileSizeEx(hFile, &liSize) && liSize.QuadPart <= MAXDWORD;
+        if (bRead)
+        {
+            bytes.resize((SIZE_T)liSize.QuadPart);
+            bRead = bytes.empty() || (ReadFile(hFile, bytes.data(), (DWORD)bytes.size(), &dwRead, NULL) && dwRead == bytes.size());
+        }
+        CloseHandle(hFile);
+        return bRead;
+    }
+
+    void AssetLoader::Run()
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        while (!m_bStop)
+        {
+            // Highest priority first, skipping the stale queue entries
+            Handle<Job> handle = {};
+            Job* pJob = nullptr;
+            for (UINT uPriority = 0; uPriority < s_uPriorityCount && pJob == nullptr; uPriority++)
+            {
+                std::deque<Handle<Job>>& queue = m_queues[uPriority];
+                while (!queue.empty() && pJob == nullptr)
+                {
+                    handle = queue.front();
+                    queue.pop_front();
+                    pJob = m_jobs.Get(handle);
+                    if (pJob && (pJob->bStarted || (UINT)pJob->priority != uPriority))
+                        pJob = nullptr;
+                }
+            }
+            if (pJob == nullptr)
+            {
+                m_condition.wait(lock);
+                continue;
+            }
+
+            pJob->bStarted = TRUE;
+            std::wstring path = pJob->path;
+            auto decode = std::move(pJob->decode);
+            lock.unlock();
+
+            std::vector<BYTE> bytes;
+            BOOL bLoaded = FALSE;
+            BOOL bRead = ReadAsset(path.c_str(), bytes);
+            Delivery deliver = decode(bRead ? &bytes : nullptr, &bLoaded);
+
+            lock.lock();
+            BOOL bWake = m_results.empty();
+            m_results.push_back({ handle, bLoaded, std::move(deliver) });
+            if (bWake && m_hWnd)
+                PostMessageW(m_hWnd, WM_NULL, 0, 0);
+        }
     }
 }
 #endif
\ No newline at end of file
@@ -0,0 +1,409 @@
+// Checks the parts of SWL that run without a window: FormatBuffer, Pool, EventBus,
+// the PNG encoder (CRC, deflate and Adler-32 through a decoding round trip) and the rasterizer.
+#define SWL_IMPLEMENTATION
+#include "../SWL.hpp"
+
+#include <cstdio>
+#include <cstring>
+#include <cwchar>
+#include <stdexcept>
+
+static int g_nFailures = 0;
+
+#define CHECK(condition) \
+    do \
+    { \
+        if (!(condition)) \
+        { \
+            fprintf(stderr, "%s(%d): CHECK(%s) failed\n", __FILE__, __LINE__, #condition); \
+            g_nFailures++; \
+        } \
+    } while (0)
+
+/*=========================================================================
+ * FormatBuffer
+ *=========================================================================*/
+static void TestFormatBuffer()
+{
+    SWL::FormatBuffer<64> buffer;
+    buffer << L"n=" << 42 << L' ' << -7LL << L' ' << 1.5 << L' ' << true << L' ' << 'x';
+    CHECK(wcscmp(buffer.GetText(), L"n=42 -7 1.5 true x") == 0);
+
+    buffer.Clear().AppendPadded(7, 3, L'0').Append(L'|').AppendFixed(3.14159, 2);
+    CHECK(wcscmp(buffer.GetText(), L"007|3.14") == 0);
+
+    buffer.Clear().AppendDuration(0.0125);
+    CHECK(wcscmp(buffer.GetText(), L"12.5 ms") == 0);
+
+    // Text past the capacity is truncated
+    SWL::FormatBuffer<4> small;
+    small << L"abcdef";
+    CHECK(small.IsFull() && wcscmp(small.GetText(), L"abcd") == 0);
+}
+
+/*=========================================================================
+ * Pool
+ *=========================================================================*/
+static void TestPool()
+{
+    SWL::Pool<int> pool;
+    SWL::Handle<int> first = pool.Create(1);
+    SWL::Handle<int> second = pool.Create(2);
+    CHECK(pool.GetCount() == 2);
+    CHECK(*pool.Get(first) == 1 && *pool.Get(second) == 2);
+
+    CHECK(pool.Destroy(first));
+    CHECK(!pool.Destroy(first));
+    CHECK(pool.Get(first) == nullptr);
+    CHECK(*pool.Get(second) == 2);
+
+    // The slot is reused with a new generation, the old handle stays stale
+    SWL::Handle<int> third = pool.Create(3);
+    CHECK(third.GetIndex() == first.GetIndex() && third != first);
+    CHECK(pool.Get(first) == nullptr && *pool.Get(third) == 3);
+
+    int nSum = 0;
+    for (int nValue : pool)
+        nSum += nValue;
+    CHECK(nSum == 5);
+    CHECK(!SWL::Handle<int>() && pool.Get(SWL::Handle<int>()) == nullptr);
+}
+
+/*=========================================================================
+ * EventBus
+ *=========================================================================*/
+struct ClickEvent
+{
+    int x;
+};
+
+struct KeyEvent
+{
+    int nKey;
+};
+
+using TestBus = SWL::EventBus<ClickEvent, KeyEvent>;
+
+struct Listener
+{
+    TestBus* pBus = nullptr;
+    int nClicks = 0;
+    int nKeys = 0;
+
+    void OnClick(const ClickEvent& event) { nClicks += event.x; }
+    void OnKey(const KeyEvent& event)
+    {
+        nKeys++;
+        // Events posted while flushing wait for the next Flush
+        if (event.nKey == 1)
+            pBus->Post(KeyEvent{ 2 });
+    }
+};
+
+static void ThrowingHandler(void*, const ClickEvent& event)
+{
+    if (event.x < 0)
+        throw std::runtime_error("handler failure");
+}
+
+static void TestEventBus()
+{
+    TestBus bus;
+    Listener listener;
+    listener.pBus = &bus;
+    bus.Subscribe<&Listener::OnClick>(&listener);
+    bus.Subscribe<&Listener::OnKey>(&listener);
+
+    bus.Publish(ClickEvent{ 3 });
+    CHECK(listener.nClicks == 3);
+
+    bus.Post(KeyEvent{ 1 });
+    CHECK(listener.nKeys == 0);
+    bus.Flush();
+    CHECK(listener.nKeys == 1);
+    bus.Flush();
+    CHECK(listener.nKeys == 2);
+
+    bus.Unsubscribe<&Listener::OnClick>(&listener);
+    bus.Publish(ClickEvent{ 5 });
+    CHECK(listener.nClicks == 3);
+
+    // A throwing handler leaves the events it did not reach queued
+    bus.Subscribe<ClickEvent>(ThrowingHandler);
+    bus.Subscribe<&Listener::OnClick>(&listener);
+    bus.Post(ClickEvent{ -1 });
+    bus.Post(ClickEvent{ 10 });
+    BOOL bThrown = FALSE;
+    try
+    {
+        bus.Flush();
+    }
+    catch (const std::runtime_error&)
+    {
+        bThrown = TRUE;
+    }
+    CHECK(bThrown);
+    bus.Flush();
+    CHECK(listener.nClicks == 13);
+}
+
+/*=========================================================================
+ * PngEncoder
+ *=========================================================================*/
+static UINT32 ReadU32(const BYTE* p)
+{
+    return ((UINT32)p[0] << 24) | ((UINT32)p[1] << 16) | ((UINT32)p[2] << 8) | p[3];
+}
+
+static UINT32 Crc32(const BYTE* pData, SIZE_T size)
+{
+    UINT32 uCrc = 0xFFFFFFFF;
+    for (SIZE_T i = 0; i < size; i++)
+    {
+        uCrc ^= pData[i];
+        for (int k = 0; k < 8; k++)
+            uCrc = (uCrc & 1) ? 0xEDB88320u ^ (uCrc >> 1) : uCrc >> 1;
+    }
+    return ~uCrc;
+}
+
+// Inflates a zlib stream made of stored and fixed Huffman blocks, which is all the encoder writes
+static BOOL Inflate(const std::vector<BYTE>& stream, std::vector<BYTE>& out)
+{
+    static const UINT16 lengthBase[29] = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+        35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+    static const UINT16 distanceBase[30] = { 1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+        257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577 };
+
+    if (stream.size() < 6 || ((stream[0] << 8) | stream[1]) % 31 != 0 || (stream[0] & 0x0F) != 8)
+        return FALSE;
+
+    SIZE_T bitPosition = 16;
+    SIZE_T bitEnd = (stream.size() - 4) * 8;
+    auto Bits = [&](int nCount)
+    {
+        UINT32 uValue = 0;
+        for (int i = 0; i < nCount && bitPosition < bitEnd; i++, bitPosition++)
+            uValue |= ((stream[bitPosition >> 3] >> (bitPosition & 7)) & 1u) << i;
+        return uValue;
+    };
+    // Huffman codes are packed from their most significant bit
+    auto Code = [&](int nCount)
+    {
+        UINT32 uValue = 0;
+        for (int i = 0; i < nCount; i++)
+            uValue = (uValue << 1) | Bits(1);
+        return uValue;
+    };
+    auto Literal = [&]() -> int
+    {
+        UINT32 uCode = Code(7);
+        if (uCode <= 0x17)
+            return 256 + uCode;
+        uCode = (uCode << 1) | Code(1);
+        if (uCode >= 0x30 && uCode <= 0xBF)
+            return uCode - 0x30;
+        if (uCode >= 0xC0 && uCode <= 0xC7)
+            return 280 + uCode - 0xC0;
+        return 144 + (((uCode << 1) | Code(1)) - 0x190);
+    };
+
+    BOOL bFinal = FALSE;
+    while (!bFinal)
+    {
+        if (bitPosition >= bitEnd)
+            return FALSE;
+        bFinal = Bits(1);
+        UINT32 uType = Bits(2);
+        if (uType == 0)
+        {
+            bitPosition = (bitPosition + 7) & ~(SIZE_T)7;
+            UINT32 uLength = Bits(16);
+            if ((Bits(16) ^ 0xFFFF) != uLength || bitPosition + uLength * 8 > bitEnd)
+                return FALSE;
+            out.insert(out.end(), stream.begin() + bitPosition / 8, stream.begin() + bitPosition / 8 + uLength);
+            bitPosition += uLength * 8;
+        }
+        else if (uType == 1)
+        {
+            for (;;)
+            {
+                int nSymbol = Literal();
+                if (nSymbol < 256)
+                {
+                    out.push_back((BYTE)nSymbol);
+                    continue;
+                }
+                if (nSymbol == 256)
+                    break;
+                if (nSymbol > 285)
+                    return FALSE;
+
+                int nIndex = nSymbol - 257;
+                int nLengthExtra = nIndex < 8 || nIndex == 28 ? 0 : (nIndex - 4) / 4;
+                UINT32 uLength = lengthBase[nIndex] + Bits(nLengthExtra);
+                UINT32 uDistanceCode = Code(5);
+                if (uDistanceCode >= 30)
+                    return FALSE;
+                int nDistanceExtra = uDistanceCode < 4 ? 0 : (int)(uDistanceCode - 2) / 2;
+                UINT32 uDistance = distanceBase[uDistanceCode] + Bits(nDistanceExtra);
+                if (uDistance > out.size())
+                    return FALSE;
+                for (UINT32 i = 0; i < uLength; i++)
+                    out.push_back(out[out.size() - uDistance]);
+            }
+        }
+        else
+        {
+            return FALSE;
+        }
+    }
+
+    // Adler-32 of the whole inflated data, combined by the encoder from the parallel blocks
+    UINT32 a = 1, b = 0;
+    for (BYTE value : out)
+    {
+        a = (a + value) % 65521;
+        b = (b + a) % 65521;
+    }
+    return ReadU32(stream.data() + stream.size() - 4) == (a | (b << 16));
+}
+
+static BYTE Paeth(int a, int b, int c)
+{
+    int p = a + b - c;
+    int pa = abs(p - a), pb = abs(p - b), pc = abs(p - c);
+    return (BYTE)(pa <= pb && pa <= pc ? a : pb <= pc ? b : c);
+}
+
+static void TestPngEncoder()
+{
+    const int nWidth = 301;
+    const int nHeight = 97;
+    SWL::Image image(nWidth, nHeight);
+    const SWL::Surface& surface = image.GetSurface();
+    for (int y = 0; y < nHeight; y++)
+    {
+        for (int x = 0; x < nWidth; x++)
+        {
+            // Gradients compress with matches, the noise band keeps literals
+            UINT32 uNoise = (UINT32)(x * 7919 + y * 104729) * 2654435761u;
+            surface.GetRow(y)[x] = y < 40 ? 0xFF000000 | (x << 16) | (y << 8) | ((x + y) & 0xFF) : uNoise;
+        }
+    }
+
+    const wchar_t* pFileName = L"SwlTest.png";
+    SWL::PngEncoder(4).Save(pFileName, surface, TRUE);
+
+    std::vector<BYTE> file;
+    if (FILE* pFile = _wfopen(pFileName, L"rb"))
+    {
+        BYTE buffer[4096];
+        SIZE_T read;
+        while ((read = fread(buffer, 1, sizeof(buffer), pFile)) > 0)
+            file.insert(file.end(), buffer, buffer + read);
+        fclose(pFile);
+    }
+    DeleteFileW(pFileName);
+
+    static const BYTE signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+    CHECK(file.size() > 8 && memcmp(file.data(), signature, 8) == 0);
+    if (file.size() <= 8)
+        return;
+
+    std::vector<BYTE> stream;
+    BOOL bEnd = FALSE;
+    for (SIZE_T offset = 8; offset + 12 <= file.size() && !bEnd; )
+    {
+        UINT32 uLength = ReadU32(&file[offset]);
+        const BYTE* pType = &file[offset + 4];
+        if (offset + 12 + uLength > file.size())
+            break;
+        CHECK(Crc32(pType, 4 + uLength) == ReadU32(pType + 4 + uLength));
+        if (memcmp(pType, "IHDR", 4) == 0)
+            CHECK(ReadU32(pType + 4) == (UINT32)nWidth && ReadU32(pType + 8) == (UINT32)nHeight && pType[13] == 6);
+        else if (memcmp(pType, "IDAT", 4) == 0)
+            stream.insert(stream.end(), pType + 4, pType + 4 + uLength);
+        bEnd = memcmp(pType, "IEND", 4) == 0;
+        offset += 12 + uLength;
+    }
+    CHECK(bEnd);
+
+    std::vector<BYTE> filtered;
+    CHECK(Inflate(stream, filtered));
+    SIZE_T rowSize = (SIZE_T)nWidth * 4;
+    CHECK(filtered.size() == (rowSize + 1) * nHeight);
+    if (filtered.size() != (rowSize + 1) * nHeight)
+        return;
+
+    std::vector<BYTE> prior(rowSize), row(rowSize);
+    BOOL bMatch = TRUE;
+    for (int y = 0; y < nHeight; y++)
+    {
+        const BYTE* pLine = &filtered[y * (rowSize + 1)];
+        for (SIZE_T i = 0; i < rowSize; i++)
+        {
+            int a = i >= 4 ? row[i - 4] : 0, b = prior[i], c = i >= 4 ? prior[i - 4] : 0;
+            int nPredictor = pLine[0] == 1 ? a : pLine[0] == 2 ? b : pLine[0] == 3 ? (a + b) / 2 : pLine[0] == 4 ? Paeth(a, b, c) : 0;
+            row[i] = (BYTE)(pLine[1 + i] + nPredictor);
+        }
+        for (int x = 0; x < nWidth; x++)
+        {
+            UINT32 uPixel = surface.GetRow(y)[x];
+            const BYTE* p = &row[x * 4];
+            bMatch &= p[0] == (BYTE)(uPixel >> 16) && p[1] == (BYTE)(uPixel >> 8) && p[2] == (BYTE)uPixel && p[3] == (BYTE)(uPixel >> 24);
+        }
+        prior.swap(row);
+    }
+    CHECK(bMatch);
+}
+
+/*=========================================================================
+ * Rasterizer
+ *=========================================================================*/
+static void TestRasterizer()
+{
+    // A square covering pixels 2 to 5 fully and half of the pixels around it
+    SWL::Path path;
+    path.MoveTo(1.5f, 1.5f);
+    path.LineTo(6.5f, 1.5f);
+    path.LineTo(6.5f, 6.5f);
+    path.LineTo(1.5f, 6.5f);
+    path.Close();
+
+    SWL::Rasterizer rasterizer;
+    BYTE coverage[8 * 8] = {};
+    rasterizer.Reset(8, 8);
+    rasterizer.AddPath(path, 1, 1, 0, 0);
+    rasterizer.Resolve(coverage, 8);
+
+    CHECK(coverage[0] == 0 && coverage[7 * 8 + 7] == 0);
+    CHECK(coverage[3 * 8 + 3] == 255 && coverage[5 * 8 + 2] == 255);
+    CHECK(coverage[3 * 8 + 1] >= 126 && coverage[3 * 8 + 1] <= 129);
+    CHECK(coverage[1 * 8 + 1] >= 62 && coverage[1 * 8 + 1] <= 65);
+
+    // Resolve clears the cells, the same rasterizer draws the next shape from scratch
+    rasterizer.AddLine(0, 0, 8, 8);
+    rasterizer.AddLine(8, 8, 0, 8);
+    rasterizer.AddLine(0, 8, 0, 0);
+    rasterizer.Resolve(coverage, 8);
+    CHECK(coverage[0 * 8 + 7] == 0 && coverage[7 * 8 + 0] == 255);
+    CHECK(coverage[4 * 8 + 4] >= 126 && coverage[4 * 8 + 4] <= 129);
+}
+
+int main()
+{
+    TestFormatBuffer();
+    TestPool();
+    TestEventBus();
+    TestPngEncoder();
+    TestRasterizer();
+
+    if (g_nFailures)
+    {
+        fprintf(stderr, "%d check(s) failed\n", g_nFailures);
+        return 1;
+    }
+    printf("All checks passed\n");
+    return 0;
+}
@@ -0,0 +1,85 @@
+// Prints once per second the metrics an Application publishes with EnableMetrics.
+// Usage: MetricsMonitor <name>
+#define SWL_IMPLEMENTATION
+#include "../SWL.hpp"
+
+#include <cstdio>
+
+// Upper bound in milliseconds of the bucket reaching the given fraction of the samples,
+// formatted into szText, or "n/a" when there was no sample in the interval
+static const wchar_t* Percentile(wchar_t (&szText)[32], const UINT64* pullCounts, UINT64 ullTotal, double dFraction,
+    int nDecimals)
+{
+    if (ullTotal == 0)
+        return L"n/a";
+
+    UINT64 ullTarget = (UINT64)ceil(ullTotal * dFraction);
+    UINT64 ullSeen = 0;
+    double dBound = 0;
+    for (UINT i = 0; i < SWL::Metrics::s_uBucketCount; i++)
+    {
+        ullSeen += pullCounts[i];
+        if (ullSeen >= ullTarget)
+        {
+            dBound = (2ull << i) / 1000.0;
+            break;
+        }
+    }
+    swprintf(szText, 32, L"<%.*f ms", nDecimals, dBound);
+    return szText;
+}
+
+int wmain(int argc, wchar_t** argv)
+{
+    if (argc < 2)
+    {
+        fwprintf(stderr, L"Usage: %ls <name>\n", argv[0]);
+        return 1;
+    }
+
+    try
+    {
+        SWL::MetricsReader reader(argv[1]);
+        double dTickMilliseconds = 1000.0 / reader.GetFrequency();
+        wprintf(L"Process %lu\n", reader.GetProcessId());
+
+        SWL::Metrics previous = {};
+        for (;;)
+        {
+            SWL::Metrics metrics = {};
+            if (reader.Read(metrics))
+            {
+                // Histograms of the last second only
+                UINT64 ullDispatch[SWL::Metrics::s_uBucketCount], ullFrame[SWL::Metrics::s_uBucketCount];
+                for (UINT i = 0; i < SWL::Metrics::s_uBucketCount; i++)
+                {
+                    ullDispatch[i] = metrics.ullDispatchHistogram[i] - previous.ullDispatchHistogram[i];
+                    ullFrame[i] = metrics.ullFrameHistogram[i] - previous.ullFrameHistogram[i];
+                }
+                UINT64 ullMessages = metrics.ullMessages - previous.ullMessages;
+                UINT64 ullFrames = metrics.ullFrames - previous.ullFrames;
+
+                wchar_t szDispatch50[32], szDispatch99[32], szFrame99[32];
+                wprintf(L"%6llu msg/s  dispatch p50 %ls p99 %ls  pump %u (max %u)  |  %4llu fps  frame %.2f ms p99 %ls  render %.2f ms",
+                    ullMessages, Percentile(szDispatch50, ullDispatch, ullMessages, 0.5, 3),
+                    Percentile(szDispatch99, ullDispatch, ullMessages, 0.99, 3),
+                    metrics.uLastPumpMessages, metrics.uMaxPumpMessages, ullFrames,
+                    metrics.llLastFrameTicks * dTickMilliseconds, Percentile(szFrame99, ullFrame, ullFrames, 0.99, 2),
+                    metrics.llLastRenderTicks * dTickMilliseconds);
+                for (UINT i = 0; i < SWL::Metrics::s_uCounterCount; i++)
+                {
+                    if (metrics.llCounters[i])
+                        wprintf(L"  [%u] %lld", i, metrics.llCounters[i]);
+                }
+                wprintf(L"\n");
+                previous = metrics;
+            }
+            Sleep(1000);
+        }
+    }
+    catch (SWL::ApplicationException&)
+    {
+        fwprintf(stderr, L"No compatible metrics published as %ls\n", argv[1]);
+        return 1;
+    }
+}